@@ -11,10 +11,18 @@
 
 #include <iostream>
 #include <istream>
+#include <string>
+#include <vector>
 
 namespace Chrono {
 
 
+// A Date is stored as the number of days since January 1, 1970 (a "serial" day number),
+// so adding days, the days between two dates and comparing dates are a single int operation.
+// year(), month() and day() convert back to the calendar (see civil_from_days()).
+// Everything but the stream I/O is constexpr, and defined below: a constexpr Date is checked
+// by the compiler (an invalid one doesn't compile) and is just a constant at run time.
+
 class Date {
 public:
     enum class Month {
@@ -23,43 +31,301 @@ public:
 
     class Invalid { };               //throw as an exception
 
-    Date(int y, Month m, int d);       // check for valid date and initialize
-    Date();                            // default constructor
+    constexpr Date(int y, Month m, int d);       // check for valid date and initialize
+    constexpr Date();                            // default constructor
+    static constexpr Date from_days(int n);      // the date n days after January 1, 1970 (before it if n<0)
     // the default copy operations are fine
 
     // non-modifying operations: const ensures that fnc can't modify
-    int   day()   const { return d; }
-    Month month() const { return m; }
-    int   year()  const { return y; }
+    constexpr int   day()   const;
+    constexpr Month month() const;
+    constexpr int   year()  const;
+    constexpr int   days()  const { return n; }  // days since January 1, 1970
 
     // modifying operations:
-    void set_day(int n);
-    void set_month(int n);
-    void set_year(int n);
+    constexpr void set_day(int n);               // throws Invalid if the month has no day n
+    constexpr void set_month(int n);             // throws Invalid if the month has no such day
+    constexpr void set_year(int n);              // adds n years
+    constexpr void add_days(int n);              // n can be negative; throws Invalid past min_year or max_year
 private:
-    int   y;
-    Month m;
-    int   d;
+    int   n;                           // days since January 1, 1970
 };
 
+static_assert(sizeof(Date)==4, "a Date is its day number, no more");   // many can be kept in memory
+
+//------------------------------------------------------------------------------
+
+constexpr int min_year = -5000000;     // the years a Date can hold: its days fit in an int
+constexpr int max_year =  5000000;
+
+//------------------------------------------------------------------------------
+//check if is leapyear
+constexpr bool leapyear(int y)
+{
+    //leap year is divisible by 4, but not 100. Exception: years divisible by 400 are leapyears.
+    return (y%4==0 && y%100!=0) || y%400==0;
+}
+
+//------------------------------------------------------------------------------
+// days before the first of each month, in a common year and in a leap year.
+// month_start[leap][m]-month_start[leap][m-1] is the length of month m; [12] is the length of the year
+
+constexpr int month_start[2][13] = {
+    { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365 },
+    { 0, 31, 60, 91, 121, 152, 182, 213, 244, 274, 305, 335, 366 }
+};
+
+constexpr int days_in_month(int y, Date::Month m)   // m must be a month
+{
+    return month_start[leapyear(y)][int(m)] - month_start[leapyear(y)][int(m)-1];
+}
+
+//------------------------------------------------------------------------------
+// helper functions: (not members of Date class)
+
+constexpr bool is_date(int y, Date::Month m, int d)   // true for valid date
+{
+    if (y<min_year || max_year<y) return false;   // the days since 1970 must fit in an int
+
+    if (m<Date::Month::jan || Date::Month::dec<m) return false;
+
+    if (d<=0) return false;            // d must be positive
+
+    return d<=days_in_month(y,m);
+}
+
 //------------------------------------------------------------------------------
+// conversions between the calendar and days since January 1, 1970, for a valid date.
+// Constant time, without loops and with almost no branches (after H. Hinnant, "chrono-
+// Compatible Low-Level Date Algorithms"): each is about twenty integer operations.
+// The calendar is counted from March 1 of year 0, so the leap day is the last day of a year, and
+// in eras of 400 years (146097 days), which all have the same pattern of leap years. A year of
+// an era is yoe (0..399), a day of the era doe (0..146096), a day of the year doy (0..365).
+// The months from March have 31,30,31,30,31 days twice and then 31,(28 or 29): the day of
+// the year a month starts is (153*mp+2)/5 for mp = 0 for March ... 11 for February.
+
+constexpr int days_from_civil(int y, Date::Month m, int d)
+{
+    int mm = int(m);
+    y -= mm<=2;                                        // January and February are the end of the year before
+    int era = (y>=0 ? y : y-399) / 400;                // rounds down, also for negative years
+    int yoe = y - era*400;
+    int doy = (153*(mm>2 ? mm-3 : mm+9) + 2)/5 + d-1;
+    int doe = yoe*365 + yoe/4 - yoe/100 + doy;
+    return era*146097 + doe - 719468;                  // 719468 days from March 1, 0 to January 1, 1970
+}
 
-bool is_date(int y, Date::Month m, int d); // true for valid date
+constexpr void civil_from_days(int n, int& y, Date::Month& m, int& d)
+{
+    n += 719468;
+    int era = (n>=0 ? n : n-146096) / 146097;
+    int doe = n - era*146097;
+    int yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;   // leaves out the leap days before doe
+    int doy = doe - (365*yoe + yoe/4 - yoe/100);
+    int mp = (5*doy + 2)/153;
+    d = doy - (153*mp+2)/5 + 1;
+    int mm = mp<10 ? mp+3 : mp-9;
+    m = Date::Month(mm);
+    y = yoe + era*400 + (mm<=2);
+}
 
 //------------------------------------------------------------------------------
+// member function definitions:
+
+constexpr Date::Date(int yy, Month mm, int dd)
+    : n(is_date(yy,mm,dd) ? days_from_civil(yy,mm,dd) : throw Invalid())   //Invalid is a class with no members
+{
+}
+
+//default constructor: the start of 21st century
+constexpr Date::Date()
+    : Date(2001,Month::jan,1)
+{
+}
+
+constexpr Date Date::from_days(int n)
+{
+    Date dd;
+    dd.n = n;
+    return dd;
+}
+
+constexpr int Date::day() const
+{
+    int y = 0, d = 0;
+    Month m = Month::jan;
+    civil_from_days(n,y,m,d);
+    return d;
+}
 
-bool leapyear(int y);                  // true if y is a leap year
+constexpr Date::Month Date::month() const
+{
+    int y = 0, d = 0;
+    Month m = Month::jan;
+    civil_from_days(n,y,m,d);
+    return m;
+}
+
+constexpr int Date::year() const
+{
+    int y = 0, d = 0;
+    Month m = Month::jan;
+    civil_from_days(n,y,m,d);
+    return y;
+}
+
+constexpr void Date::set_day(int dd)
+{
+    int y = 0, d = 0;
+    Month m = Month::jan;
+    civil_from_days(n,y,m,d);
+    *this = Date(y,m,dd);        // throws Invalid for i.e. June 31: use add_days() to go on to the next month
+}
+
+constexpr void Date::set_month(int mm)
+{
+    int y = 0, d = 0;
+    Month m = Month::jan;
+    civil_from_days(n,y,m,d);
+    *this = Date(y,Month(mm),d);
+}
+
+constexpr void Date::set_year(int nn)
+{
+    int y = 0, d = 0;
+    Month m = Month::jan;
+    civil_from_days(n,y,m,d);
+    if (m==Month::feb && d==29 && !leapyear(y+nn)) { // beware of leap years!
+        m = Month::mar;        // use March 1 instead of February 29
+        d = 1;
+    }
+    *this = Date(y+nn,m,d);
+}
+
+constexpr void Date::add_days(int dd)
+{
+    long long nn = (long long)n + dd;            // n+dd could overflow an int
+    if (nn<days_from_civil(min_year,Month::jan,1) || days_from_civil(max_year,Month::dec,31)<nn) throw Invalid();
+    n = int(nn);
+}
 
 //------------------------------------------------------------------------------
 
-bool operator==(const Date& a, const Date& b);
-bool operator!=(const Date& a, const Date& b);
+constexpr bool operator==(const Date& a, const Date& b) { return a.days()==b.days(); }
+constexpr bool operator!=(const Date& a, const Date& b) { return !(a==b); }
+constexpr bool operator<(const Date& a, const Date& b)  { return a.days()<b.days(); }
+constexpr bool operator<=(const Date& a, const Date& b) { return a.days()<=b.days(); }
+constexpr bool operator>(const Date& a, const Date& b)  { return a.days()>b.days(); }
+constexpr bool operator>=(const Date& a, const Date& b) { return a.days()>=b.days(); }
+
+constexpr int operator-(const Date& a, const Date& b) { return a.days()-b.days(); }   // the days from b to a
+
+//------------------------------------------------------------------------------
+// the calendar fields of a date, other than year(), month() and day()
+
+enum class Day {
+    sunday, monday, tuesday, wednesday, thursday, friday, saturday
+};
+
+constexpr Day day_of_week(const Date& d)
+{
+    return Day((d.days()%7 + 11) % 7);       // January 1, 1970 was a Thursday; % of a negative int is negative
+}
+
+constexpr int day_of_year(const Date& d)     // 1 for January 1
+{
+    return d.days() - days_from_civil(d.year(),Date::Month::jan,1) + 1;
+}
+
+constexpr int quarter(const Date& d)         // 1 for January to March
+{
+    return (int(d.month())+2) / 3;
+}
+
+// ISO 8601: weeks start on Monday, and week 1 of a year is the week with its first Thursday,
+// so December 31 can be in week 1 of the next year and January 1 in week 52 or 53 of the last.
+
+struct Iso_week {
+    int year;
+    int week;                                // 1..53
+};
+
+constexpr Iso_week iso_week(const Date& d)
+{
+    Date thursday = Date::from_days(d.days() + 3 - (int(day_of_week(d))+6)%7);   // from d back to Monday, then on
+                                             // to Thursday: in max_year+1 for the last days of max_year
+    return Iso_week{thursday.year(), (day_of_year(thursday)-1)/7 + 1};
+}
 
 //------------------------------------------------------------------------------
 
 std::ostream& operator<<(std::ostream& os, const Date& d);
 std::istream& operator>>(std::istream& is, Date& dd);
 
+//------------------------------------------------------------------------------
+// Reading many dates at once (Chrono_parse.cpp): text with a date on each line, as (y,m,d)
+// (what operator>> reads, with optional blanks) or as YYYY-MM-DD. Blank lines are skipped.
+// A line that isn't a date doesn't stop the rest: it is reported in errors, by line number.
+// The text is read with no streams and no copy: the digits of a number are found and
+// converted eight characters at a time in a 64-bit integer (SWAR), and the dates are checked
+// and converted to day numbers a block at a time, without a branch per date.
+
+struct Line_error {
+    enum class Kind { format, invalid_date };   // neither format, or no such date (i.e. (2018,6,31))
+    long line;                                  // 1 for the first line
+    Kind kind;
+};
+
+struct Parsed_dates {
+    std::vector<Date> dates;                    // of the lines that are dates, in order
+    std::vector<Line_error> errors;             // the lines that aren't, in order
+};
+
+Parsed_dates parse_dates(const char* first, const char* last);
+Parsed_dates parse_date_file(const std::string& path);   // memory mapped where the system can do that
+
+//------------------------------------------------------------------------------
+// Many dates in one array (Chrono_array.cpp): the day numbers, one int each, side by side.
+// As a Date is ordered as its day number, sorting and selecting a range only compare ints.
+// year(), month(), day() and the other calendar fields are computed for the whole array, a block
+// of dates at a time, with arithmetic the compiler does in SIMD registers.
+
+class DateArray {
+public:
+    DateArray() { }
+    explicit DateArray(const std::vector<Date>& v);
+
+    std::size_t size() const { return n.size(); }
+    Date operator[](std::size_t i) const { return Date::from_days(n[i]); }
+    const int* days() const { return n.data(); }        // the days since January 1, 1970 of each
+    void push_back(Date d) { n.push_back(d.days()); }
+
+    std::vector<int> years() const;                     // year() of each date, in order
+    std::vector<int> months() const;                    // int(month()), 1 for January
+    std::vector<int> days_of_month() const;             // day()
+    std::vector<int> days_of_week() const;              // int(day_of_week()), 0 for Sunday
+    std::vector<int> days_of_year() const;              // day_of_year()
+    std::vector<int> iso_weeks() const;                 // iso_week().week
+    std::vector<int> iso_years() const;                 // iso_week().year
+    std::vector<int> quarters() const;                  // quarter()
+
+    void sort();                                        // earliest first
+    std::size_t count_between(Date first, Date last) const;   // the dates with first<=d && d<=last
+    DateArray between(Date first, Date last) const;           // those dates, in order
+private:
+    std::vector<int> n;
+};
+
+bool operator==(const DateArray& a, const DateArray& b);    // the same dates in the same order
+bool operator!=(const DateArray& a, const DateArray& b);
+
+std::ostream& operator<<(std::ostream& os, const DateArray& a);   // a Date on each line, as parse_dates() reads
+
+// for the days n[0]..n[count-1]: civil_from_days(), and the fields a report on them needs,
+// computed together; int(day_of_week()), day_of_year(), iso_week().week and quarter()
+void civil_from_days(const int* n, int* y, int* m, int* d, std::size_t count);
+void calendar_fields(const int* n, int* week_day, int* year_day, int* iso_week, int* quarter, std::size_t count);
+
 //------------------------------------------------------------------------------
 
 } // Chrono
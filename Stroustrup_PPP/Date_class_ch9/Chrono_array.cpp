@@ -0,0 +1,234 @@
+//
+// Many dates in one array: see DateArray in Chrono.h.
+//
+// The dates are converted lanes at a time: a loop of a fixed count over arrays that don't
+// overlap, with no branches, which the compiler turns into SIMD instructions at -O2 (eight
+// dates per instruction with -mavx2, four with SSE2). civil_from_days() of Chrono.h has a
+// branch for the era of a negative day number, and divides ints, which SIMD registers can't.
+// Here x/c is int((x+0.5)*(1/c)) in floating point: x/c is an integer or at least 1/c from
+// one, so (x+0.5)/c is at least 0.5/c from one, much more than the rounding error, and
+// truncating it gives x/c. The era is computed in double, from a day number moved on by
+// whole eras so that it is never negative; the rest, for a day of the era, in float.
+// The month and the day are found as in Neri and Schneider, "Euclidean affine functions
+// and their application to calendar algorithms", with a multiplication and a shift.
+// The day of the week comes from the day of the era, as an era is a whole number of weeks,
+// and the ISO week from a second conversion, of the Thursday of the week.
+// Sorting is a radix sort, which doesn't compare at all: three passes of 11 bits, and a pass is
+// left out when all the dates have the same bits there (as dates of the same thousand years do).
+//
+
+#include "Chrono.h"
+#include <algorithm>
+#include <cstdint>
+
+namespace Chrono {
+
+//------------------------------------------------------------------------------
+
+const int lanes = 16;                                   // dates converted in one loop
+
+constexpr int eras_before = 12506;                      // eras of 400 years before min_year
+constexpr double shift = 719468 + 146097.0*eras_before; // (see days_from_civil()): 0 is March 1, -5002400
+
+static_assert(days_from_civil(min_year,Date::Month::jan,1) + shift >= 0, "not enough eras_before");
+
+enum Field {
+    year_field, month_field, day_field, week_day_field, year_day_field, iso_week_field, iso_year_field, quarter_field,
+    fields
+};
+
+static inline void civil_day(int n, int& y, int& m, int& d, int& year_day, int& week_day)
+    // as civil_from_days(), with day_of_year() and day_of_week()
+{
+    int era = int((n + (shift+0.5)) * (1.0/146097)) - eras_before;
+    int doe = n + 719468 - era*146097;
+    int yoe = doe - int((doe+0.5f)*(1.0f/1460)) + int((doe+0.5f)*(1.0f/36524)) - (doe==146096);
+    yoe = int((yoe+0.5f)*(1.0f/365));
+    int century = yoe*41>>12;                          // yoe/100, for yoe<400
+    int doy = doe - (365*yoe + yoe/4 - century);
+    int md = 2141*doy + 197913;                        // the month (3 for March) in the high 16 bits,
+    int next_year = doy>=306;                          // the day-1 times 2141 in the low ones
+    int leap = (yoe%4==0) & ((yoe!=century*100) | (yoe==0));    // of the year from January; yoe%400 is 0 just for yoe 0
+    y = yoe + era*400 + next_year;
+    m = (md>>16) - 12*next_year;
+    d = ((md&0xFFFF)*31345>>26) + 1;                   // /2141
+    year_day = next_year ? doy-305 : doy+60+leap;
+    int w = doe + 3;                                   // each era starts on a Wednesday (an era is 20871 weeks)
+    week_day = w - 7*int((w+0.5f)*(1.0f/7));
+}
+
+template<unsigned wanted>                              // the fields f with wanted & 1<<f are stored in out[f]
+static inline void calendar_lanes(const int* __restrict n, int (* __restrict out)[lanes])
+{
+    for (int i = 0; i<lanes; ++i) {
+        int y, m, d, yd, wd;
+        civil_day(n[i], y, m, d, yd, wd);
+        int ty, tm, td, tyd, twd;                      // the Thursday of the week (from Monday) decides its year
+        civil_day(n[i] + 3 - (wd==0 ? 6 : wd-1), ty, tm, td, tyd, twd);
+        if (wanted & 1u<<year_field) out[year_field][i] = y;
+        if (wanted & 1u<<month_field) out[month_field][i] = m;
+        if (wanted & 1u<<day_field) out[day_field][i] = d;
+        if (wanted & 1u<<week_day_field) out[week_day_field][i] = wd;
+        if (wanted & 1u<<year_day_field) out[year_day_field][i] = yd;
+        if (wanted & 1u<<iso_week_field) out[iso_week_field][i] = ((tyd-1)*293>>11) + 1;   // /7
+        if (wanted & 1u<<iso_year_field) out[iso_year_field][i] = ty;
+        if (wanted & 1u<<quarter_field) out[quarter_field][i] = (m+2)*11>>5;               // /3
+    }
+}
+
+template<unsigned wanted>
+static void calendar(const int* n, int* const out[fields], std::size_t count)
+{
+    int block[fields][lanes];
+    std::size_t i = 0;
+    for (; i+lanes<=count; i += lanes) {
+        calendar_lanes<wanted>(n+i, block);
+        for (int f = 0; f<fields; ++f)
+            if (wanted & 1u<<f) std::copy(block[f], block[f]+lanes, out[f]+i);   // a few SIMD stores
+    }
+    if (i == count) return;
+
+    int last[lanes] = { };                             // the last few dates, and then day 0
+    std::copy(n+i, n+count, last);
+    calendar_lanes<wanted>(last, block);
+    for (int f = 0; f<fields; ++f)
+        if (wanted & 1u<<f) std::copy(block[f], block[f]+(count-i), out[f]+i);
+}
+
+template<Field f>
+static std::vector<int> calendar_field(const std::vector<int>& n)
+{
+    std::vector<int> v(n.size());
+    int* out[fields] = { };
+    out[f] = v.data();
+    calendar<1u<<f>(n.data(), out, n.size());
+    return v;
+}
+
+void civil_from_days(const int* n, int* y, int* m, int* d, std::size_t count)
+{
+    int* out[fields] = { y, m, d };
+    calendar<1u<<year_field | 1u<<month_field | 1u<<day_field>(n, out, count);
+}
+
+void calendar_fields(const int* n, int* week_day, int* year_day, int* iso_week, int* quarter, std::size_t count)
+{
+    int* out[fields] = { };
+    out[week_day_field] = week_day;
+    out[year_day_field] = year_day;
+    out[iso_week_field] = iso_week;
+    out[quarter_field] = quarter;
+    calendar<1u<<week_day_field | 1u<<year_day_field | 1u<<iso_week_field | 1u<<quarter_field>(n, out, count);
+}
+
+//------------------------------------------------------------------------------
+
+DateArray::DateArray(const std::vector<Date>& v)
+    : n(v.size())
+{
+    for (std::size_t i = 0; i<v.size(); ++i) n[i] = v[i].days();
+}
+
+std::vector<int> DateArray::years() const { return calendar_field<year_field>(n); }
+std::vector<int> DateArray::months() const { return calendar_field<month_field>(n); }
+std::vector<int> DateArray::days_of_month() const { return calendar_field<day_field>(n); }
+std::vector<int> DateArray::days_of_week() const { return calendar_field<week_day_field>(n); }
+std::vector<int> DateArray::days_of_year() const { return calendar_field<year_day_field>(n); }
+std::vector<int> DateArray::iso_weeks() const { return calendar_field<iso_week_field>(n); }
+std::vector<int> DateArray::iso_years() const { return calendar_field<iso_year_field>(n); }
+std::vector<int> DateArray::quarters() const { return calendar_field<quarter_field>(n); }
+
+//------------------------------------------------------------------------------
+
+static uint32_t key(int n) { return uint32_t(n) ^ 0x80000000; }   // ordered as n, as an unsigned int
+
+void DateArray::sort()
+{
+    if (n.size() < 1024) {                             // not worth three passes over the counts
+        std::sort(n.begin(), n.end());
+        return;
+    }
+    const int bits = 11;
+    const int digits = 1<<bits;
+    std::vector<std::size_t> count(3*digits);          // how many of each digit, for each pass
+    for (int x : n) {
+        uint32_t k = key(x);
+        ++count[k & (digits-1)];
+        ++count[digits + (k>>bits & (digits-1))];
+        ++count[2*digits + (k>>2*bits)];
+    }
+
+    std::vector<int> other(n.size());
+    int* from = n.data();
+    int* to = other.data();
+    for (int pass = 0; pass<3; ++pass) {
+        std::size_t* c = &count[pass*digits];
+        int s = pass*bits;
+        if (c[key(from[0])>>s & (digits-1)] == n.size()) continue;   // all the same: nothing moves
+        std::size_t start = 0;
+        for (int i = 0; i<digits; ++i) {               // where the dates of each digit start
+            std::size_t k = c[i];
+            c[i] = start;
+            start += k;
+        }
+        for (std::size_t i = 0; i<n.size(); ++i)
+            to[c[key(from[i])>>s & (digits-1)]++] = from[i];
+        std::swap(from,to);
+    }
+    if (from != n.data()) n.swap(other);
+}
+
+//------------------------------------------------------------------------------
+// is first<=n[i] && n[i]<=last: one unsigned compare, n[i]-first is very large for n[i]<first
+
+std::size_t DateArray::count_between(Date first, Date last) const
+{
+    if (last < first) return 0;
+    uint32_t low = uint32_t(first.days());
+    uint32_t width = uint32_t(last.days()) - low;          // last-first could overflow an int
+    std::size_t count = 0;
+    for (int x : n) count += uint32_t(x) - low <= width;
+    return count;
+}
+
+DateArray DateArray::between(Date first, Date last) const
+{
+    DateArray a;
+    std::size_t count = count_between(first,last);     // a pass over n costs less than a larger a.n
+    if (count == 0) return a;
+    uint32_t low = uint32_t(first.days());
+    uint32_t width = uint32_t(last.days()) - low;
+    a.n.resize(count+1);
+    std::size_t k = 0;
+    for (int x : n) {                                  // each date is written, and kept if it is in range
+        a.n[k] = x;
+        k += uint32_t(x) - low <= width;
+    }
+    a.n.pop_back();
+    return a;
+}
+
+//------------------------------------------------------------------------------
+
+bool operator==(const DateArray& a, const DateArray& b)
+{
+    return a.size()==b.size() && std::equal(a.days(), a.days()+a.size(), b.days());
+}
+
+bool operator!=(const DateArray& a, const DateArray& b)
+{
+    return !(a==b);
+}
+
+std::ostream& operator<<(std::ostream& os, const DateArray& a)
+{
+    std::vector<int> y(a.size()), m(a.size()), d(a.size());
+    civil_from_days(a.days(), y.data(), m.data(), d.data(), a.size());
+    for (std::size_t i = 0; i<a.size(); ++i)
+        os << '(' << y[i] << ',' << m[i] << ',' << d[i] << ")\n";    // as << for a Date
+    return os;
+}
+
+//------------------------------------------------------------------------------
+
+} // end of Chrono
@@ -0,0 +1,224 @@
+//
+// Reading many dates at once: see parse_dates() in Chrono.h.
+//
+// operator>> reads a date with seven formatted extractions from a stream. Here the text is
+// a buffer (a memory mapped file, where the system can do that) and each line is read in
+// place: memchr() finds its end, and each number is read with a single 8-byte load.
+// The lines are read into a block of (y,m,d); the whole block is then checked and converted
+// to day numbers in one loop, with no branch on whether a date is valid.
+//
+
+#include "Chrono.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CHRONO_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Chrono {
+
+//------------------------------------------------------------------------------
+// SWAR: eight characters in a uint64_t, the first one in the low byte
+
+static uint64_t load8(const char* p, const char* end)     // the characters at p; 0 for those at or after end
+{
+    uint64_t v = 0;
+    std::memcpy(&v, p, std::min<std::ptrdiff_t>(8, end-p));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static int leading_digits(uint64_t v)       // how many of the characters, from the first, are digits
+{
+    const uint64_t high = 0xF0F0F0F0F0F0F0F0;
+    const uint64_t zeros = 0x3030303030303030;
+    uint64_t x = ((v & high) ^ zeros) | (((v + 0x0606060606060606) & high) ^ zeros);  // 0 for '0'..'9': 0x30..0x39, +6 still 0x3_
+    uint64_t t = (x | (x<<1) | (x<<2) | (x<<3)) & 0x8080808080808080;                   // the top bit of each byte that isn't 0
+    return t ? __builtin_ctzll(t)/8 : 8;
+}
+
+static int digits_value(uint64_t v, int n)  // the number in the first n (1..8) characters, which are digits
+{
+    v <<= 8*(8-n);                                          // the n digits to the top, zeros (leading '0's) below
+    v -= 0x3030303030303030ULL << 8*(8-n);
+    v = v*10 + (v>>8);                                      // each pair of digits, in every other byte
+    v = ((v & 0x000000FF000000FF) * (100 + (1000000ULL<<32))
+         + ((v>>16) & 0x000000FF000000FF) * (1 + (10000ULL<<32))) >> 32;
+    return int(v);
+}
+
+//------------------------------------------------------------------------------
+
+static bool is(const char* p, const char* eol, char c)
+{
+    return p!=eol && *p==c;
+}
+
+const int too_big = 99999999;       // a number of 8 or more digits: no part of a date is that long
+
+static const char* number(const char* p, const char* end, int& value, int& digits)
+    // read the digits at p: nullptr if there are none
+{
+    uint64_t v = load8(p,end);
+    digits = leading_digits(v);
+    if (digits == 0) return nullptr;
+    if (digits == 8) {
+        while (p!=end && '0'<=*p && *p<='9') ++p;
+        value = too_big;
+        return p;
+    }
+    value = digits_value(v,digits);
+    return p+digits;
+}
+
+static const char* signed_number(const char* p, const char* eol, const char* end, int& value)
+    // as >> reads an int: with an optional sign
+{
+    bool negative = is(p,eol,'-');
+    if (negative || is(p,eol,'+')) ++p;
+    int digits = 0;
+    p = number(p,end,value,digits);
+    if (negative) value = -value;
+    return p;
+}
+
+static const char* blanks(const char* p, const char* eol)
+{
+    while (p!=eol && (*p==' ' || *p=='\t' || *p=='\r')) ++p;
+    return p;
+}
+
+//------------------------------------------------------------------------------
+
+enum class Line { date, blank, bad };
+
+static Line read_line(const char* p, const char* eol, const char* end, int& y, int& m, int& d)
+    // the line from p to eol (its '\n', or end)
+{
+    p = blanks(p,eol);
+    if (p == eol) return Line::blank;
+    int digits = 0;
+    if (*p == '(') {                                        // (y,m,d)
+        if (!(p = signed_number(blanks(p+1,eol),eol,end,y))) return Line::bad;
+        p = blanks(p,eol);
+        if (!is(p,eol,',')) return Line::bad;
+        if (!(p = signed_number(blanks(p+1,eol),eol,end,m))) return Line::bad;
+        p = blanks(p,eol);
+        if (!is(p,eol,',')) return Line::bad;
+        if (!(p = signed_number(blanks(p+1,eol),eol,end,d))) return Line::bad;
+        p = blanks(p,eol);
+        if (!is(p,eol,')')) return Line::bad;
+        ++p;
+    }
+    else {                                                  // YYYY-MM-DD
+        if (!(p = number(p,end,y,digits)) || digits!=4 || !is(p,eol,'-')) return Line::bad;
+        if (!(p = number(p+1,end,m,digits)) || digits!=2 || !is(p,eol,'-')) return Line::bad;
+        if (!(p = number(p+1,end,d,digits)) || digits!=2) return Line::bad;
+    }
+    return blanks(p,eol) == eol ? Line::date : Line::bad;
+}
+
+//------------------------------------------------------------------------------
+
+const int block = 256;              // lines read before they are checked together
+
+struct Block {
+    int y[block];
+    int m[block];
+    int d[block];
+    bool read[block];               // the line had the format of a date
+    long line[block];
+    int days[block];
+    bool valid[block];
+    int n = 0;
+};
+
+static void check(Block& b)         // is_date() and days_from_civil() for the block, without branches
+{
+    for (int i = 0; i<b.n; ++i) {
+        int y = std::min(std::max(b.y[i],min_year),max_year);    // within range, so nothing overflows
+        int m = std::min(std::max(b.m[i],1),12);
+        int d = std::min(std::max(b.d[i],1),31);
+        b.valid[i] = b.read[i] & (y==b.y[i]) & (m==b.m[i]) & (d==b.d[i]) & (d<=days_in_month(y,Date::Month(m)));
+        b.days[i] = days_from_civil(y,Date::Month(m),d);
+    }
+}
+
+static void flush(Block& b, Parsed_dates& out)
+{
+    check(b);
+    for (int i = 0; i<b.n; ++i) {
+        if (b.valid[i]) out.dates.push_back(Date::from_days(b.days[i]));
+        else out.errors.push_back(Line_error{b.line[i], b.read[i] ? Line_error::Kind::invalid_date : Line_error::Kind::format});
+    }
+    b.n = 0;
+}
+
+//------------------------------------------------------------------------------
+
+Parsed_dates parse_dates(const char* first, const char* last)
+{
+    Parsed_dates out;
+    out.dates.reserve((last-first)/11);                     // "2018-06-05\n"
+    Block b;
+    long line = 0;
+    for (const char* p = first; p<last; ) {
+        const char* eol = static_cast<const char*>(std::memchr(p,'\n',last-p));
+        if (!eol) eol = last;
+        ++line;
+        int i = b.n;
+        Line kind = read_line(p,eol,last,b.y[i],b.m[i],b.d[i]);
+        p = eol+1;
+        if (kind == Line::blank) continue;
+        b.read[i] = kind==Line::date;
+        if (!b.read[i]) b.y[i] = b.m[i] = b.d[i] = 1;
+        b.line[i] = line;
+        if (++b.n == block) flush(b,out);
+    }
+    flush(b,out);
+    return out;
+}
+
+//------------------------------------------------------------------------------
+
+Parsed_dates parse_date_file(const std::string& path)
+{
+#ifdef CHRONO_HAVE_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("can't open date file " + path);
+    struct stat st;
+    if (fstat(fd,&st) == 0 && st.st_size > 0) {
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            close(fd);
+            madvise(p, st.st_size, MADV_SEQUENTIAL);    // read front to back, once
+            const char* data = static_cast<const char*>(p);
+            Parsed_dates out = parse_dates(data, data+st.st_size);
+            munmap(p, st.st_size);
+            return out;
+        }
+    }
+    close(fd);
+#endif
+    std::ifstream is(path, std::ios_base::binary);     // no mmap: read the file into one buffer
+    if (!is) throw std::runtime_error("can't open date file " + path);
+    std::ostringstream os;
+    os << is.rdbuf();
+    std::string contents = os.str();
+    return parse_dates(contents.data(), contents.data()+contents.size());
+}
+
+//------------------------------------------------------------------------------
+
+} // end of Chrono
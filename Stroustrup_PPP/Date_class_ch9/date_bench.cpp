@@ -0,0 +1,337 @@
+//
+// Benchmarks for the Date class. See Chrono.h.
+//
+// Build: g++ -std=c++17 -O2 Chrono.cpp Chrono_parse.cpp Chrono_array.cpp date_bench.cpp -o date_bench
+// (add -mavx2, or -march=native, for the DateArray kernels to use 256 bit registers)
+//
+// is_date: the month_start table of Chrono.h against the switch is_date() used to have,
+// over random (y,m,d) where about one in eight is not a date.
+// Constructing: Date(y,m,d) from values only known at run time, against a constexpr Date,
+// which the compiler has already checked and turned into its day number.
+// Parsing: a text of a date per line, read with >> as (y,m,d) against parse_dates(), for
+// (y,m,d) and for YYYY-MM-DD, from a string and with parse_date_file() from a file.
+// DateArray: year(), month() and day(), sorting and selecting a range of dates, for a
+// vector<Date> one Date at a time against a DateArray of the same dates.
+// Calendar fields: day_of_week(), day_of_year(), iso_week() and quarter() of each Date,
+// against calendar_fields() for all the dates at once.
+//
+
+#include "Chrono.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+using namespace Chrono;
+
+//------------------------------------------------------------------------------
+
+double seconds_since(chrono::steady_clock::time_point t0)
+{
+    return chrono::duration<double>(chrono::steady_clock::now()-t0).count();
+}
+
+//------------------------------------------------------------------------------
+// is_date() as it was, with a switch on the month
+
+bool is_date_switch(int y, Date::Month m, int d)
+{
+    if (d<=0) return false;
+
+    int days_in_month = 31;
+
+    switch (m) {
+    case Date::Month::feb:
+        days_in_month = (leapyear(y))?29:28;
+        break;
+    case Date::Month::apr: case Date::Month::jun: case Date::Month::sep: case Date::Month::nov:
+        days_in_month = 30;
+        break;
+    default:
+        break;
+    }
+
+    return d<=days_in_month;
+}
+
+//------------------------------------------------------------------------------
+
+struct Ymd {
+    int y;
+    Date::Month m;
+    int d;
+};
+
+vector<Ymd> make_ymds(int n)
+{
+    mt19937 gen(2018);
+    uniform_int_distribution<int> year(1600,2400);
+    uniform_int_distribution<int> month(1,12);
+    uniform_int_distribution<int> day(1,32);      //29..32 aren't always dates
+    vector<Ymd> v(n);
+    for (Ymd& x : v) x = Ymd{year(gen), Date::Month(month(gen)), day(gen)};
+    return v;
+}
+
+//------------------------------------------------------------------------------
+
+void bench_is_date(int n, int passes)
+{
+    vector<Ymd> v = make_ymds(n);
+
+    int valid_table = 0;
+    auto t0 = chrono::steady_clock::now();
+    for (int p = 0; p<passes; ++p)
+        for (const Ymd& x : v) valid_table += is_date(x.y,x.m,x.d);
+    double t_table = seconds_since(t0);
+
+    int valid_switch = 0;
+    t0 = chrono::steady_clock::now();
+    for (int p = 0; p<passes; ++p)
+        for (const Ymd& x : v) valid_switch += is_date_switch(x.y,x.m,x.d);
+    double t_switch = seconds_since(t0);
+
+    double total = double(n)*passes;
+    cout << "is_date: " << n << " dates, " << passes << " passes\n"
+         << "  switch : " << t_switch*1e9/total << " ns/date\n"
+         << "  table  : " << t_table*1e9/total << " ns/date\n"
+         << "  speedup: " << t_switch/t_table << "\n"
+         << "  same results: " << (valid_table == valid_switch ? "yes" : "no") << "\n";
+}
+
+//------------------------------------------------------------------------------
+
+void bench_construct(int n, int passes)
+{
+    vector<Ymd> v = make_ymds(n);
+    for (Ymd& x : v) if (!is_date(x.y,x.m,x.d)) x.d = 1;     //no exceptions in the loop
+
+    long long sum_runtime = 0;
+    auto t0 = chrono::steady_clock::now();
+    for (int p = 0; p<passes; ++p)
+        for (const Ymd& x : v) sum_runtime += Date(x.y,x.m,x.d).days();
+    double t_runtime = seconds_since(t0);
+
+    long long sum_constant = 0;
+    t0 = chrono::steady_clock::now();
+    for (int p = 0; p<passes; ++p)
+        for (int i = 0; i<n; ++i) {
+            constexpr Date start {2018,Date::Month::jun,5};
+            sum_constant += start.days() + i;
+        }
+    double t_constant = seconds_since(t0);
+
+    double total = double(n)*passes;
+    cout << "constructing: " << n << " dates, " << passes << " passes\n"
+         << "  Date(y,m,d) at run time : " << t_runtime*1e9/total << " ns/date\n"
+         << "  constexpr Date          : " << t_constant*1e9/total << " ns/date (the loop only)\n"
+         << "  (checksums " << sum_runtime << ' ' << sum_constant << ")\n";
+}
+
+//------------------------------------------------------------------------------
+
+string make_date_text(int n, bool iso)      //a date per line, one in a thousand isn't one
+{
+    vector<Ymd> v = make_ymds(n);
+    ostringstream os;
+    for (int i = 0; i<n; ++i) {
+        const Ymd& x = v[i];
+        int d = is_date(x.y,x.m,x.d) || i%1000==0 ? x.d : 1;
+        if (iso) {
+            char buf[16];
+            snprintf(buf, sizeof(buf), "%04d-%02d-%02d", x.y, int(x.m), d);
+            os << buf << '\n';
+        }
+        else os << '(' << x.y << ',' << int(x.m) << ',' << d << ")\n";
+    }
+    return os.str();
+}
+
+void bench_parse(int n)
+{
+    string text = make_date_text(n, false);
+    auto t0 = chrono::steady_clock::now();
+    istringstream is(text);
+    vector<Date> streamed;
+    int stream_errors = 0;
+    while (is) {
+        Date dd;
+        try {
+            if (is >> dd) streamed.push_back(dd);
+        }
+        catch (Date::Invalid&) {
+            ++stream_errors;
+        }
+    }
+    double t_stream = seconds_since(t0);
+
+    t0 = chrono::steady_clock::now();
+    Parsed_dates parsed = parse_dates(text.data(), text.data()+text.size());
+    double t_parse = seconds_since(t0);
+
+    string iso = make_date_text(n, true);
+    t0 = chrono::steady_clock::now();
+    Parsed_dates parsed_iso = parse_dates(iso.data(), iso.data()+iso.size());
+    double t_iso = seconds_since(t0);
+
+    const char* file = "date_bench_parse.tmp";
+    ofstream(file, ios_base::binary) << iso;
+    t0 = chrono::steady_clock::now();
+    Parsed_dates parsed_file = parse_date_file(file);
+    double t_file = seconds_since(t0);
+    remove(file);
+
+    cout << "parsing: " << n << " dates (" << text.size()/1e6 << " MB as (y,m,d))\n"
+         << "  >> (y,m,d)              : " << t_stream*1e9/n << " ns/date\n"
+         << "  parse_dates (y,m,d)     : " << t_parse*1e9/n << " ns/date, " << text.size()/t_parse/1e6 << " MB/s"
+         << " (speedup " << t_stream/t_parse << ")\n"
+         << "  parse_dates YYYY-MM-DD  : " << t_iso*1e9/n << " ns/date, " << iso.size()/t_iso/1e6 << " MB/s\n"
+         << "  parse_date_file         : " << t_file*1e9/n << " ns/date, " << iso.size()/t_file/1e6 << " MB/s\n"
+         << "  same dates: " << (streamed == parsed.dates && parsed.dates == parsed_iso.dates && parsed_iso.dates == parsed_file.dates ? "yes" : "no")
+         << ", errors: " << stream_errors << ' ' << parsed.errors.size() << ' ' << parsed_iso.errors.size() << "\n";
+}
+
+//------------------------------------------------------------------------------
+
+void bench_date_array(int n, int passes)
+{
+    vector<Ymd> ymds = make_ymds(n);
+    vector<Date> v;
+    v.reserve(n);
+    for (const Ymd& x : ymds) v.push_back(Date(x.y,x.m,is_date(x.y,x.m,x.d) ? x.d : 1));
+    DateArray a(v);
+
+    long long sum_dates = 0;
+    auto t0 = chrono::steady_clock::now();
+    for (int p = 0; p<passes; ++p)
+        for (const Date& dd : v) sum_dates += dd.year() + int(dd.month()) + dd.day();
+    double t_fields = seconds_since(t0);
+
+    long long sum_array = 0;
+    vector<int> y(n), m(n), d(n);
+    t0 = chrono::steady_clock::now();
+    for (int p = 0; p<passes; ++p) {
+        civil_from_days(a.days(), y.data(), m.data(), d.data(), n);
+        for (int i = 0; i<n; ++i) sum_array += y[i] + m[i] + d[i];
+    }
+    double t_array_fields = seconds_since(t0);
+
+    long long sum_years = 0;
+    t0 = chrono::steady_clock::now();
+    for (int p = 0; p<passes; ++p)
+        for (const Date& dd : v) sum_years += dd.year();
+    double t_year = seconds_since(t0);
+
+    long long sum_array_years = 0;
+    t0 = chrono::steady_clock::now();
+    for (int p = 0; p<passes; ++p)
+        for (int x : a.years()) sum_array_years += x;
+    double t_array_year = seconds_since(t0);
+
+    constexpr Date first {1900,Date::Month::jan,1};
+    constexpr Date last {1999,Date::Month::dec,31};
+    size_t in_range = 0;
+    t0 = chrono::steady_clock::now();
+    for (int p = 0; p<passes; ++p) {
+        vector<Date> r;
+        copy_if(v.begin(), v.end(), back_inserter(r), [&](const Date& dd) { return first<=dd && dd<=last; });
+        in_range += r.size();
+    }
+    double t_range = seconds_since(t0);
+
+    size_t in_array_range = 0;
+    t0 = chrono::steady_clock::now();
+    for (int p = 0; p<passes; ++p) in_array_range += a.between(first,last).size();
+    double t_array_range = seconds_since(t0);
+
+    vector<Date> sorted = v;
+    t0 = chrono::steady_clock::now();
+    sort(sorted.begin(), sorted.end());
+    double t_sort = seconds_since(t0);
+
+    DateArray array_sorted = a;
+    t0 = chrono::steady_clock::now();
+    array_sorted.sort();
+    double t_array_sort = seconds_since(t0);
+
+    double total = double(n)*passes;
+    cout << "DateArray: " << n << " dates (" << sizeof(Date) << " bytes each), " << passes << " passes\n"
+         << "  year(),month(),day() of each Date : " << t_fields*1e9/total << " ns/date\n"
+         << "  civil_from_days() of the array    : " << t_array_fields*1e9/total << " ns/date"
+         << " (speedup " << t_fields/t_array_fields << ")\n"
+         << "  year() of each Date               : " << t_year*1e9/total << " ns/date\n"
+         << "  years()                           : " << t_array_year*1e9/total << " ns/date"
+         << " (speedup " << t_year/t_array_year << ")\n"
+         << "  copy_if first<=d && d<=last       : " << t_range*1e9/total << " ns/date\n"
+         << "  between(first,last)               : " << t_array_range*1e9/total << " ns/date"
+         << " (speedup " << t_range/t_array_range << ")\n"
+         << "  std::sort vector<Date>            : " << t_sort*1e9/n << " ns/date\n"
+         << "  DateArray::sort                   : " << t_array_sort*1e9/n << " ns/date"
+         << " (speedup " << t_sort/t_array_sort << ")\n"
+         << "  same results: " << (sum_dates==sum_array && sum_years==sum_array_years && in_range==in_array_range && array_sorted==DateArray(sorted) ? "yes" : "no") << "\n";
+}
+
+//------------------------------------------------------------------------------
+
+void bench_calendar_fields(int n, int passes)
+{
+    vector<Ymd> ymds = make_ymds(n);
+    vector<Date> v;
+    v.reserve(n);
+    for (const Ymd& x : ymds) v.push_back(Date(x.y,x.m,is_date(x.y,x.m,x.d) ? x.d : 1));
+    DateArray a(v);
+
+    long long sum_dates = 0;
+    auto t0 = chrono::steady_clock::now();
+    for (int p = 0; p<passes; ++p)
+        for (const Date& dd : v)
+            sum_dates += int(day_of_week(dd)) + day_of_year(dd) + iso_week(dd).week + quarter(dd);
+    double t_dates = seconds_since(t0);
+
+    long long sum_array = 0;
+    vector<int> week_day(n), year_day(n), week(n), q(n);
+    t0 = chrono::steady_clock::now();
+    for (int p = 0; p<passes; ++p) {
+        calendar_fields(a.days(), week_day.data(), year_day.data(), week.data(), q.data(), n);
+        for (int i = 0; i<n; ++i) sum_array += week_day[i] + year_day[i] + week[i] + q[i];
+    }
+    double t_array = seconds_since(t0);
+
+    long long sum_weeks = 0;
+    t0 = chrono::steady_clock::now();
+    for (int p = 0; p<passes; ++p)
+        for (const Date& dd : v) sum_weeks += iso_week(dd).week;
+    double t_week = seconds_since(t0);
+
+    long long sum_array_weeks = 0;
+    t0 = chrono::steady_clock::now();
+    for (int p = 0; p<passes; ++p)
+        for (int x : a.iso_weeks()) sum_array_weeks += x;
+    double t_array_week = seconds_since(t0);
+
+    double total = double(n)*passes;
+    cout << "calendar fields: " << n << " dates, " << passes << " passes\n"
+         << "  day_of_week(),day_of_year(),iso_week(),quarter() : " << t_dates*1e9/total << " ns/date, "
+         << total/t_dates/1e6 << " M dates/s\n"
+         << "  calendar_fields()                                : " << t_array*1e9/total << " ns/date, "
+         << total/t_array/1e6 << " M dates/s (speedup " << t_dates/t_array << ")\n"
+         << "  iso_week().week of each Date                     : " << t_week*1e9/total << " ns/date\n"
+         << "  iso_weeks()                                      : " << t_array_week*1e9/total << " ns/date"
+         << " (speedup " << t_week/t_array_week << ")\n"
+         << "  same results: " << (sum_dates==sum_array && sum_weeks==sum_array_weeks ? "yes" : "no") << "\n";
+}
+
+//------------------------------------------------------------------------------
+
+int main()
+{
+    bench_is_date(1000000, 20);
+    bench_construct(1000000, 20);
+    bench_parse(5000000);
+    bench_date_array(10000000, 5);
+    bench_calendar_fields(10000000, 5);
+}
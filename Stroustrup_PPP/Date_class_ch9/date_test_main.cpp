@@ -13,13 +13,22 @@ using namespace std;
 int main()
 try
 {
-    Chrono::Date today{2018, Chrono::Date::Month::jun, 5};        //initialize a date
+    constexpr Chrono::Date today{2018, Chrono::Date::Month::jun, 5};   //initialize a date, checked by the compiler
     Chrono::Date tomorrow = today;
-    tomorrow.set_day(today.day() + 1);                     //+1 to today to get tomorrow
+    tomorrow.add_days(1);                                  //also right at the end of a month or year
 
     cout << "today " << today <<endl;                  //<< was overloaded for Date objects
     cout << "tomorrow " << tomorrow << endl;
 
+    constexpr Chrono::Date new_year{2019, Chrono::Date::Month::jan, 1};
+    static_assert(new_year - today == 210, "days until new year");
+    cout << "days until " << new_year << ": " << new_year - today << endl;
+
+    static_assert(Chrono::day_of_week(today) == Chrono::Day::tuesday, "June 5, 2018 was a Tuesday");
+    constexpr Chrono::Iso_week week = Chrono::iso_week(today);
+    cout << "day " << Chrono::day_of_year(today) << " of " << week.year << ", week " << week.week
+         << ", quarter " << Chrono::quarter(today) << endl;
+
     return 0;
 
 }
@@ -23,6 +23,9 @@
 
    Functions available: sqrt() and pow(x,i) = x^i. x and i can be any expression.
 
+   Arrays are written [1, 2, 3]: let v = [1, 2, 3]; v*2 + v; sqrt(v); are arrays, element by element.
+   sum(v), min(v), max(v), mean(v) and dot(v, w) turn them into numbers.
+
    Variable names must start with a letter and can have numbers, but no special symbols.
    End each expression with ; followed by [Enter] to print the results. Use 'quit' to quit.
 
@@ -65,6 +68,12 @@
         Name
         sqrt ( Expression )
         pow(Expression, int)
+        [ Expression { , Expression } ]
+        sum ( Expression )
+        min ( Expression )
+        max ( Expression )
+        mean ( Expression )
+        dot ( Expression , Expression )
         ( Expression )
         - Primary
         + Primary
@@ -72,65 +81,29 @@
         floating-point-literal
 
 
-        Input comes from cin through the Token_stream called ts.
-*/
-
-#include "std_lib_facilities.h"
-
-//-----------------------------------------------------------------------------------
-const char number = '8';        // t.kind==number means that t is a number Token
-const char quit   = 'q';        // t.kind==quit means that t is a quit Token
-const char print  = ';';        // t.kind==print means that t is a print Token
-const char name   = 'a';        // name token
-const char let    = 'L';        // declaration token
-const char square_root   = 's';  //square root token
-const char power = 'p';          //power token
-const string declkey = "let";   // declaration keyword
-const string quitkey = "quit";  //quit keyword
-const string prompt  = "> ";
-const string result  = "= ";    // used to indicate that what follows is a result
-const string sqrt_key    = "sqrt";  //square root keyword
-const string power_key = "pow";    //power keyword
-
-//-------------------------------------------------------------------------------
-
-struct Token {
-    char kind;          //kind of token
-    double value;       //value for numbers
-    string name;        //name for variables
-    Token(char ch)             :kind{ch}, value{0} { }     //for operators/letters
-    Token(char ch, double val) :kind{ch}, value{val} { }   //for numbers
-    Token(char ch, string n)   :kind{ch}, name{n} { }     //for variables
-};
+        Input comes from cin through the Token_stream called ts,
+        or from a script file given on the command line.
 
-//------------------------------------------------------------------------------------
-
-class Token_stream {
-public:
-    Token_stream() :  full(false), buffer(0) { }   //reads from cin
-    Token get();                                   //get a Token
-    void unget(Token t);    //put the got Token back. Token t is stored in buffer.
-    void ignore(char c);   //discard tokens up to and including a particular char. Used for clean_up_mess() after an error occurs
-private:
-    bool full;            //is there a Token in the buffer?
-    Token buffer;         //keep Token put back using unget() here
-};
+    Each statement is first compiled into a Program (see calculator.h) and then run.
+    The compiled Program can be run again without parsing the statement again.
+*/
 
-//--------------------------------------------------------------------------------------------
+#include "calculator.h"
+#include <charconv>
+#include <cstdint>
+#include <cstring>
 
-struct Variable {
-    string name;
-    double value;
-    Variable(string n, double v) :name(n), value(v) { }
-};
+#if defined(__unix__) || defined(__APPLE__)
+#define CALC_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 //------------------------------------------------------------------------------------------
 
-
-double expression(Token_stream &ts);
-
-
-vector<Variable> var_names;   //store names of variables
+Symbol_table symbols;   //store names of variables
 
 //----------------------------------------------------------------------------------
 
@@ -143,32 +116,244 @@ void Token_stream::unget(Token t)  //Put the got Token back. Token t is stored i
 
 //--------------------------------------------------------------------------------------
 
-void set_value(string s, double d)           //set the value of variable named s to d
+size_t Symbol_table::hash(string_view s)   //FNV-1a
 {
-    for (int i = 0; i<=var_names.size(); ++i)
-        if (var_names[i].name == s) {
-            var_names[i].value = d;
-            return;
+    size_t h = 14695981039346656037ull;
+    for (char c : s) {
+        h ^= (unsigned char)c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+//---------------------------------------------------------------------------------
+
+int Symbol_table::find(string_view s) const
+{
+    Phase_timer timer(Phase::lookup);
+    stats_count(Counter::lookups);
+    size_t h = hash(s);
+    size_t mask = index.size()-1;          //the size of index is a power of 2
+    for (size_t i = h&mask; ; i = (i+1)&mask) {
+        int slot = index[i];
+        if (slot < 0) return -1;           //an empty entry ends the search
+        if (hashes[slot] == h && names[slot] == s) return slot;
+    }
+}
+
+//---------------------------------------------------------------------------------
+
+void Symbol_table::insert(int slot)
+{
+    size_t mask = index.size()-1;
+    size_t i = hashes[slot]&mask;
+    while (index[i] >= 0) i = (i+1)&mask;
+    index[i] = slot;
+}
+
+//---------------------------------------------------------------------------------
+
+Symbol_table::Symbol_table(const Symbol_table& st)
+    : index(16, -1), reactive(false), epoch(0)
+{
+    *this = st;
+}
+
+//---------------------------------------------------------------------------------
+
+Symbol_table& Symbol_table::operator=(const Symbol_table& st)
+{
+    if (this == &st) return *this;
+    name_store.reset();
+    names.clear();
+    for (string_view s : st.names) names.push_back(name_store.copy(s));
+    hashes = st.hashes;
+    vals = st.vals;
+    arrays = st.arrays;
+    declared = st.declared;
+    constant = st.constant;
+    index = st.index;
+    reactive = st.reactive;
+    formulas = st.formulas;           //a Formula doesn't change, so the tables can share it
+    dependents = st.dependents;
+    visited = st.visited;
+    epoch = st.epoch;
+    return *this;
+}
+
+//---------------------------------------------------------------------------------
+
+int Symbol_table::intern(string_view s)
+{
+    int slot = find(s);
+    if (slot >= 0) return slot;
+    slot = names.size();
+    names.push_back(name_store.copy(s));
+    hashes.push_back(hash(s));
+    vals.push_back(0);
+    arrays.push_back(vector<double>());
+    declared.push_back(false);
+    constant.push_back(false);
+    formulas.push_back(nullptr);
+    dependents.push_back(vector<int>());
+    visited.push_back(0);
+    if (2*names.size() > index.size()) {     //keep the table at most half full, so searches stay short
+        index.assign(2*index.size(), -1);
+        for (int i = 0; i<names.size(); ++i) insert(i);
+    }
+    else insert(slot);
+    return slot;
+}
+
+//---------------------------------------------------------------------------------
+
+void Symbol_table::declare_constant(string_view s, double d)
+{
+    int slot = intern(s);
+    declare(slot, d);
+    constant[slot] = true;
+}
+
+//---------------------------------------------------------------------------------
+
+void Symbol_table::declare_array(int slot, const vector<double>& elements)
+{
+    declare(slot, numeric_limits<double>::quiet_NaN());
+    arrays[slot] = elements;
+}
+
+//---------------------------------------------------------------------------------
+
+struct Formula {       //the code of a let, for a reactive Symbol_table
+    vector<Instruction> code;
+    int stack_size;
+    int temps;
+    vector<int> sources;        //the slots the code loads, each once
+};
+
+//---------------------------------------------------------------------------------
+
+void Symbol_table::set_value(string_view s, double d)           //set the value of variable named s to d
+{
+    int slot = find(s);
+    if (slot < 0 || !is_declared(slot)) error("set: undefined name ",string(s));
+    if (is_array(slot)) error("set: can't assign to array ",string(s));
+    set(slot, d);
+    if (!reactive) return;
+    if (formulas[slot]) {       //slot isn't computed any more: it's an input like any other
+        for (int source : formulas[slot]->sources) {
+            vector<int>& v = dependents[source];
+            v.erase(std::find(v.begin(), v.end(), slot));
         }
-    error("set: undefined name ",s);
+        formulas[slot] = nullptr;
+    }
+    update(slot);
+}
+
+//---------------------------------------------------------------------------------
+
+bool Symbol_table::is_declared(string_view s) const      //check is variable is already declared
+{
+    int slot = find(s);
+    return slot >= 0 && is_declared(slot);
+}
+
+//---------------------------------------------------------------------------------
+
+int Symbol_table::get_slot(string_view s) const       //return the slot of variable named s, the compiled code refers to variables by slot
+{
+    int slot = find(s);
+    if (slot < 0 || !is_declared(slot)) error("get: undefined name ",string(s));
+    return slot;
 }
 
 //---------------------------------------------------------------------------------
 
-bool is_declared(string s)      //check is variable is already declared (already in var_names vector)
+void set_value(string_view s, double d) { symbols.set_value(s, d); }
+bool is_declared(string_view s) { return symbols.is_declared(s); }
+int get_slot(string_view s) { return symbols.get_slot(s); }
+
+//-------------------------------------------------------------------------------
+
+bool Token_stream::more()
+{
+    while (true) {
+        while (cur!=last && isspace(*cur)) ++cur;
+        if (cur!=last) return true;
+        if (!in) return false;                  //a file is read all at once
+        Phase_timer timer(Phase::input);
+        if (!getline(*in,line)) return false;
+        cur = line.data();
+        last = cur+line.size();
+    }
+}
+
+//-------------------------------------------------------------------------------
+//read a floating-point-literal from [p:last) into val, return the position after it.
+//Accepts what cin >> val accepts: digits, optional . and digits, optional e notation.
+//The value is correctly rounded, like cin >> val (which uses strtod), but no locale or stream is involved.
+
+const double exact_powers_of_10[] = {     //10^0 to 10^22 are exact as doubles
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+const char* read_number(const char* p, const char* last, double& val)
 {
-    for (int i = 0; i<var_names.size(); ++i)
-        if (var_names[i].name == s) return true;
-    return false;
+    const char* first = p;
+    unsigned long long mant = 0;    //the significant digits, while there are at most 19 of them
+    int sig = 0;                    //number of significant digits (leading zeros don't count)
+    int digits = 0;                 //number of digits before the e
+    int exp10 = 0;                  //val is mant*10^exp10
+    while (p!=last && isdigit(*p)) {
+        if (mant != 0 || *p != '0') { mant = mant*10 + (*p-'0'); ++sig; }
+        ++p; ++digits;
+    }
+    if (p!=last && *p=='.') {
+        ++p;
+        while (p!=last && isdigit(*p)) {
+            if (mant != 0 || *p != '0') { mant = mant*10 + (*p-'0'); ++sig; }
+            --exp10;
+            ++p; ++digits;
+        }
+    }
+    if (digits == 0) return nullptr;             //i.e. just a .
+    if (p!=last && (*p=='e' || *p=='E')) {
+        ++p;
+        bool negative = false;
+        if (p!=last && (*p=='+' || *p=='-')) negative = *p++=='-';
+        if (p==last || !isdigit(*p)) return nullptr;       //i.e. 1e;
+        int e = 0;
+        while (p!=last && isdigit(*p)) {
+            if (e < 100000) e = e*10 + (*p-'0');     //way out of range anyway
+            ++p;
+        }
+        exp10 += negative ? -e : e;
+    }
+
+    //fast path: mant and 10^exp10 are both exact doubles, so one multiplication or division
+    //rounds correctly. That covers almost all literals people write.
+    if (sig <= 19 && mant <= (1ull<<53) && -22 <= exp10 && exp10 <= 22) {
+        double d = mant;
+        val = (exp10 < 0) ? d/exact_powers_of_10[-exp10] : d*exact_powers_of_10[exp10];
+        return p;
+    }
+
+    //slow path: long mantissa or large exponent
+    from_chars_result r = from_chars(first, p, val);
+    if (r.ec == errc::result_out_of_range) val = strtod(string(first,p).c_str(), nullptr);  //gives inf or 0
+    return p;
 }
 
 //-------------------------------------------------------------------------------
 
-Token Token_stream::get()  //read characters from cin and compose a Token
+Token Token_stream::get()  //read characters from the input and compose a Token
 {
     if (full) { full=false; return buffer; }  //check if there is a Token in the buffer, in that case return it.
-	char ch;
-    cin >> ch;        //recall that >> skips whitespace
+    Phase_timer timer(Phase::lex);
+    stats_count(Counter::tokens);
+    if (!more()) return Token(quit);          //skips whitespace. The end of the input is like quit
+	char ch = *cur++;
 	switch (ch) {
 	case '(':
 	case ')':
@@ -179,7 +364,9 @@ Token Token_stream::get()  //read characters from cin and compose a Token
 	case '%':
     case print:
 	case '=':
-    case ',':  //for pow
+    case ',':  //for pow, dot and arrays
+    case '[':
+    case ']':
         return Token(ch);  //each character represents itself
 	case '.':
 	case '0':
@@ -192,247 +379,1147 @@ Token Token_stream::get()  //read characters from cin and compose a Token
 	case '7':
 	case '8':
 	case '9':
-    {	cin.unget();  //put character back into input stream. Note: not the same unget() as we defined (this is member fnc of cin)
-		double val;
-		cin >> val;
+    {	double val;
+		const char* p = read_number(cur-1, last, val);   //the number starts with ch
+		if (!p) return Token(bad);
+		cur = p;
 		return Token(number,val);
 	}
 	default:
-        if (isalpha(ch)) {         //ifalpha checks if ch is a letter. If is a letter, then it could be part of a variable name, so start creating a string.
-			string s;
-			s += ch;
-            while(cin.get(ch) && (isalpha(ch) || isdigit(ch) || ch == '_')) s+=ch;  //while next characters are also letters or #'s, add them to string. NOTE: cin.get, does not skip whitespace.
-            cin.unget();                           //put next character back into input stream, if it's not the above.1
+        if (isalpha(ch)) {         //ifalpha checks if ch is a letter. If is a letter, then it could be part of a variable name.
+            const char* first = cur-1;
+            while(cur!=last && (isalpha(*cur) || isdigit(*cur) || *cur == '_')) ++cur;  //while next characters are also letters or #'s, they are part of the name.
+            string_view s(first, cur-first);       //no copy: s points into the input
             if (s == declkey) return Token(let);   //variable declaration keyword
             if (s == quitkey) return Token(quit);  //return token corresponding to quit
             if (s == sqrt_key) return Token(square_root);
             if (s == power_key) return Token(power);
+            for (const string& k : builtin_keys)
+                if (s == k) return Token(builtin, string_view(k));
             //check if there's an '=' after variable name
-            char next_char;
-            cin >> next_char;
-            if(next_char == '=' && is_declared(s)){
+            if (in) {
+                while (cur!=last && isspace(*cur)) ++cur;
+                if (cur == last) {      //more() will read the next line over s
+                    name_buf.assign(s.data(), s.size());
+                    s = name_buf;
+                }
+            }
+            Symbol_table& st = target ? target->symbol_table() : symbols;
+            if(more() && *cur == '=' && st.is_declared(s)){
+                int slot = st.get_slot(s);     //before get(), which can make s invalid
+                if (st.is_array(slot)) return Token(bad, st.name_of(slot));    //an array can't be assigned
+                ++cur;
                 Token t = get();
-                set_value(s, t.value);      // if have = after variable name and variable is already declared, then means is an assignment--> call expression
+                if (t.kind == bad) return t;
+                st.mark_assigned(slot);      //optimize() can't take its value as a constant any more
+                if (target) target->emit(Op::assign, slot, t.value);  //the assignment happens when the program runs
+                else st.set(slot, t.value);      // if have = after variable name and variable is already declared, then means is an assignment--> call expression
                 return t;
             }
-            cin.unget();       //return the char back to cin stream so can be read elsewhere
             return Token(name,s);
 		}
-		error("Bad token");
+		return Token(bad);
 	}
 }
 
 //---------------------------------------------------------------------------------------------------
 
-void Token_stream::ignore(char c)  //used for clean_up_mess() after an error occurs
+bool Token_stream::ignore(char c)  //used for clean_up_mess() after an error occurs
 {
     //first look in buffer:
     if (full && c==buffer.kind) {    //if find the c kind of Token there, then stop ignoring input
 		full = false;
-		return;
+		return true;
 	}
 	full = false;
 
-    // now search input: ignore, until find a c kind of Token
-	char ch;
-	while (cin>>ch)
-		if (ch==c) return;
+    // now search input: ignore, until find a c kind of Token. The rest of the buffered input is searched at once
+	while (more()) {
+		const char* p = static_cast<const char*>(memchr(cur, c, last-cur));
+		if (p) {
+			cur = p+1;
+			return true;
+		}
+		cur = last;
+	}
+	return false;
 }
 
 //---------------------------------------------------------------------------------------
 
-double get_value(string s)       //return the value of variable named s
+Input_file::Input_file(const string& path)
+    :data(nullptr), size(0), mapped(false)
 {
-    for (int i = 0; i<var_names.size(); ++i)
-        if (var_names[i].name == s) return var_names[i].value;
-	error("get: undefined name ",s);
+#ifdef CALC_HAVE_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) error("can't open input file ",path);
+    struct stat st;
+    if (fstat(fd,&st) == 0 && st.st_size > 0) {
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, st.st_size, MADV_SEQUENTIAL);    //the Token_stream reads it front to back
+            data = static_cast<const char*>(p);
+            size = st.st_size;
+            mapped = true;
+        }
+    }
+    close(fd);
+    if (mapped) return;
+#endif
+    ifstream is(path, ios_base::binary);     //no mmap: read the file into one buffer
+    if (!is) error("can't open input file ",path);
+    ostringstream os;
+    os << is.rdbuf();
+    contents = os.str();
+    data = contents.data();
+    size = contents.size();
 }
 
-//-----------------------------------------------------------------------------
-//deal with numbers and parentheses
-double primary(Token_stream &ts)
+//---------------------------------------------------------------------------------------
+
+Input_file::~Input_file()
 {
-	Token t = ts.get();
-	switch (t.kind) {
-    case '(':                    // handle '(' expression ')'
-    {	double d = expression(ts);
-		t = ts.get();
-        if (t.kind != ')') error("')' expected");
-        return d;
-	}
-	case '-':
-        return - primary(ts);       //unitary - (i.e. if expression starts with -5)
-    case '+':
-        return primary(ts);         //unitary +
-	case number:
-        return t.value;            //return number's value
-	case name:
-        return get_value(t.name);  //return variable's value
-    case square_root:
-    {    t = ts.get();
-        if (t.kind != '(') error("'(' expected");   //after sqrt should have '('
-        double e = expression(ts);
-        //check for closing )
-        t = ts.get();
-        if (t.kind != ')') error("')' expected");
-        if(e < 0) error("Can't take sqrt of negative number");
-        return sqrt(e);      //sqrt() is from STL library cmath defined in header
-    }
-    case power:
-    {   t = ts.get();
-        if (t.kind != '(') error("'(' expected");   //after pow should have '('
-        double p = expression(ts);
-        //check for ,
-        t = ts.get();
-        if (t.kind != ',') error("',' expected. Recall format for power is pow(x,i) is x^i.");
-        double i = expression(ts);
-        //check for closing )
-        t = ts.get();
-        if (t.kind != ')') error("')' expected");
-        return pow(p,i);
+#ifdef CALC_HAVE_MMAP
+    if (mapped) munmap(const_cast<char*>(data), size);
+#endif
+}
+
+//---------------------------------------------------------------------------------------
+
+Arena::~Arena()
+{
+    while (first) {
+        Block* b = first;
+        first = first->next;
+        ::operator delete(b);
     }
-	default:
-		error("primary expected");
-	}
 }
 
-//---------------------------------------------------------------------------------
+//---------------------------------------------------------------------------------------
 
-//deal with *,/, and %. Will be operated on after all primaries have been evaluated.
-double term(Token_stream &ts)
-{
-    double left = primary(ts);
-	while(true) {
-		Token t = ts.get();
-		switch(t.kind) {
-		case '*':
-            left *= primary(ts);
-			break;
-		case '/':
-        {	double d = primary(ts);
-			if (d == 0) error("divide by zero");
-			left /= d;
-			break;
-		}
-        case '%':
-                {
-                    int i1 = narrow_cast<int>(left);  //% requires int operators. cast to int.
-                    int i2 = narrow_cast<int>(term(ts));
-                    if (i2 == 0) error("%: divide by zero");
-                    left = i1%i2;
-                    break;
-                }
-        default:              //if char is non of the chars that would make this a term
-            ts.unget(t);      //put t back into  token stream so other functions can read it
-			return left;
-		}
-	}
+static char* align_up(char* p, size_t align)
+{
+    uintptr_t u = reinterpret_cast<uintptr_t>(p);
+    return p + ((align - u%align) % align);
 }
 
-//------------------------------------------------------------------------------------
-//deal with + and - (will be operated on, after all terms have been evaluated)
-double expression(Token_stream &ts)
-{
-    double left = term(ts);   //read and evaluate a term
-	while(true) {
-		Token t = ts.get();
-		switch(t.kind) {
-		case '+':
-            left += term(ts);
-			break;
-		case '-':
-            left -= term(ts);
-			break;
-		default:
-            ts.unget(t);       //if next character is not + or -, then previous thing is a term which we return.
-                               //And put the next char back into token stream since it's not something that can form an expression.
-			return left;
-		}
-	}
+//---------------------------------------------------------------------------------------
+
+void Arena::next_block(size_t n, size_t align)
+{
+    Block* b = current ? current->next : first;
+    if (!b || b->size < n+align) {            //no block to reuse that's big enough: make one
+        size_t size = max(block_size, n+align);
+        Block* nb = static_cast<Block*>(::operator new(sizeof(Block)+size));
+        nb->size = size;
+        if (current) {
+            nb->next = current->next;
+            current->next = nb;
+        }
+        else {
+            nb->next = first;
+            first = nb;
+        }
+        b = nb;
+    }
+    current = b;
+    cur = reinterpret_cast<char*>(b+1);
+    end = cur + b->size;
+}
+
+//---------------------------------------------------------------------------------------
+
+void* Arena::allocate(size_t n, size_t align)
+{
+    char* p = cur ? align_up(cur, align) : nullptr;
+    if (!p || n > size_t(end-p)) {
+        next_block(n, align);
+        p = align_up(cur, align);
+    }
+    cur = p+n;
+    return p;
+}
+
+//---------------------------------------------------------------------------------------
+
+string_view Arena::copy(string_view s)
+{
+    if (s.empty()) return s;
+    char* p = static_cast<char*>(allocate(s.size(), 1));
+    memcpy(p, s.data(), s.size());
+    return string_view(p, s.size());
+}
+
+//---------------------------------------------------------------------------------------
+
+void Arena::reset()
+{
+    current = first;
+    cur = first ? reinterpret_cast<char*>(first+1) : nullptr;
+    end = first ? cur+first->size : nullptr;
+}
+
+//---------------------------------------------------------------------------------------
+
+void Program::clear()
+{
+    code.clear();      //keeps the capacity, so compiling the next statement doesn't allocate
+    kinds.clear();
+    arrays = false;
+    pool_used = 0;
+    decl_slot = -1;
+    depth = 0;
+    max_depth = 0;
+    temps = 0;
+    captured.clear();
+    live_depth = 0;
+}
+
+//---------------------------------------------------------------------------------------
+static bool is_int(double d)        //what narrow_cast<int>(d) accepts
+{
+    return -2147483648.0 <= d && d <= 2147483647.0 && double(int(d)) == d;
+}
+
+//---------------------------------------------------------------------------------------
+//the hot loop: only dispatches instructions. The errors are the ones the grammar functions gave
+//when they evaluated the expression while reading it.
+
+static Error_code execute(const Instruction* p, const Instruction* end, double* vars, double* stack, int& sp, double* temps,
+                          Array_space* space = nullptr)   //sp: the stack depth; space: for a Program with arrays
+{
+    for ( ; p != end; ++p) {
+        switch (p->op) {
+        case Op::number:
+            stack[sp++] = p->value;
+            break;
+        case Op::load:
+            stack[sp++] = vars[p->slot];
+            break;
+        case Op::assign:
+            vars[p->slot] = p->value;
+            break;
+        case Op::negate:
+            stack[sp-1] = -stack[sp-1];
+            break;
+        case Op::add:
+            --sp;
+            stack[sp-1] += stack[sp];
+            break;
+        case Op::subtract:
+            --sp;
+            stack[sp-1] -= stack[sp];
+            break;
+        case Op::multiply:
+            --sp;
+            stack[sp-1] *= stack[sp];
+            break;
+        case Op::divide:
+            --sp;
+            if (stack[sp] == 0) return Error_code::divide_by_zero;
+            stack[sp-1] /= stack[sp];
+            break;
+        case Op::to_int:
+            if (!is_int(stack[sp-1])) return Error_code::not_int;   //% requires int operators
+            break;
+        case Op::modulo:
+            if (!is_int(stack[sp-2]) || !is_int(stack[sp-1])) return Error_code::not_int;
+            [[fallthrough]];
+        case Op::int_modulo:        //the operands are ints
+        {   --sp;
+            int i1 = int(stack[sp-1]);
+            int i2 = int(stack[sp]);
+            if (i2 == 0) return Error_code::modulo_by_zero;
+            stack[sp-1] = (i2 == -1) ? 0 : i1%i2;     //-2147483648 % -1 would overflow
+            break;
+        }
+        case Op::square_root:
+            if (stack[sp-1] < 0) return Error_code::negative_sqrt;
+            stack[sp-1] = sqrt(stack[sp-1]);
+            break;
+        case Op::power:
+            --sp;
+            stack[sp-1] = pow(stack[sp-1], stack[sp]);
+            break;
+        case Op::save:
+            temps[p->slot] = stack[sp-1];
+            break;
+        case Op::restore:
+            stack[sp++] = temps[p->slot];
+            break;
+        case Op::make_array:
+        case Op::array_load:
+        case Op::array_op:
+        case Op::reduce:
+        {   Error_code e = execute_array(*p, stack, sp, *space);
+            if (e != Error_code::none) return e;
+            break;
+        }
+        }
+    }
+    return Error_code::none;
+}
+
+//---------------------------------------------------------------------------------------
+
+bool Program::check_types(Op& op, int& slot)
+{
+    if (!arrays) {          //every entry is a number, unless this makes an array
+        if (op == Op::load) {
+            if (!table->is_array(slot)) return true;
+        }
+        else if (op != Op::make_array && op != Op::reduce) return true;
+        kinds.assign(depth, false);
+        arrays = true;
+    }
+    auto top = [&](int i) { return kinds[kinds.size()-1-i]; };
+    switch (op) {
+    case Op::number:
+    case Op::restore:
+        kinds.push_back(false);
+        break;
+    case Op::load:
+        kinds.push_back(table->is_array(slot));
+        if (kinds.back()) op = Op::array_load;
+        break;
+    case Op::negate:
+    case Op::square_root:
+        if (top(0)) {
+            slot = array_operation(op);
+            op = Op::array_op;
+        }
+        break;
+    case Op::to_int:
+        if (top(0)) return fail(Error_code::number_expected);
+        break;
+    case Op::add:
+    case Op::subtract:
+    case Op::multiply:
+    case Op::divide:
+    case Op::power:
+    {   bool a = top(1);
+        bool b = top(0);
+        kinds.pop_back();
+        if (a || b) {
+            slot = array_operation(op, (a && b) ? Operands::arrays : a ? Operands::array_number : Operands::number_array);
+            op = Op::array_op;
+            kinds.back() = true;
+        }
+        break;
+    }
+    case Op::modulo:
+        if (top(1) || top(0)) return fail(Error_code::number_expected);
+        kinds.pop_back();
+        break;
+    case Op::make_array:
+        for (int i = 0; i<slot; ++i)
+            if (top(i)) return fail(Error_code::number_expected);   //no arrays of arrays
+        kinds.resize(kinds.size()-slot);
+        kinds.push_back(true);
+        break;
+    case Op::reduce:
+        if (Reduction(slot) == Reduction::dot) {
+            if (!top(1) || !top(0)) return fail(Error_code::array_expected);
+            kinds.pop_back();
+        }
+        else if (!top(0)) return fail(Error_code::array_expected);
+        kinds.back() = false;
+        break;
+    default:                //assign and save don't change the stack
+        break;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------------------
+
+bool Program::emit(Op op, int slot, double value)
+{
+    if (!check_types(op, slot)) return false;
+    switch (op) {      //keep track of the stack depth, so run() knows how much stack it needs
+    case Op::number:
+    case Op::load:
+    case Op::restore:
+    case Op::array_load:
+        ++depth;
+        break;
+    case Op::make_array:
+        depth -= slot-1;
+        break;
+    case Op::array_op:
+        if (Op(slot/4) != Op::negate && Op(slot/4) != Op::square_root) --depth;
+        break;
+    case Op::reduce:
+        if (Reduction(slot) == Reduction::dot) --depth;
+        break;
+    case Op::add:
+    case Op::subtract:
+    case Op::multiply:
+    case Op::divide:
+    case Op::modulo:
+    case Op::int_modulo:
+    case Op::power:
+        --depth;
+        break;
+    default:           //the rest replace the top of the stack or don't use the stack
+        break;
+    }
+    if (depth > max_depth) max_depth = depth;
+    if ((op == Op::save || op == Op::restore) && slot >= temps) temps = slot+1;
+    code.push_back(Instruction{op, slot, value});
+    if (eager) {      //the grammar doesn't emit save or restore, so no temporaries
+        Phase_timer timer(Phase::eval);
+        if (live.size() < max_depth) live.resize(max_depth);
+        Array_space space {*table, pool, pool_used};
+        Error_code e = execute(&code.back(), &code.back()+1, table->values(), &live[0], live_depth, nullptr, &space);
+        pool_used = space.used;
+        if (e != Error_code::none) return fail(e);
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------------------
+
+Result Program::finish(double d) const
+{
+    if (decl_slot >= 0) {
+        if (table->is_declared(decl_slot)) return Result{0, Error{Error_code::declared_twice, table->name_of(decl_slot)}};
+        table->declare(decl_slot, d);
+        if (table->is_reactive()) table->define(decl_slot, code, max_depth, temps);
+    }
+    return Result{d, Error{}};
+}
+
+Result Program::finish_array(double handle) const
+{
+    int h = int(handle);
+    const vector<double>* a = (h < 0) ? &table->array(-h-1) : &pool[h];
+    if (decl_slot >= 0) {
+        if (table->is_declared(decl_slot)) return Result{0, Error{Error_code::declared_twice, table->name_of(decl_slot)}};
+        table->declare_array(decl_slot, *a);
+        a = &table->array(decl_slot);
+    }
+    return Result{numeric_limits<double>::quiet_NaN(), Error{}, a};
+}
+
+//---------------------------------------------------------------------------------------
+
+size_t Program::pool_bytes() const
+{
+    size_t n = pool.capacity()*sizeof(vector<double>);
+    for (const vector<double>& v : pool) n += v.capacity()*sizeof(double);
+    return n;
+}
+
+//---------------------------------------------------------------------------------------
+
+Result Program::try_run() const
+{
+    Phase_timer timer(Phase::eval);
+    const int small = 32;       //most statements need only a few stack entries and temporaries
+    double local[small];
+    vector<double> big;
+    double* stack = local;
+    if (max_depth+temps > small) {
+        big.resize(max_depth+temps);
+        stack = &big[0];
+    }
+    int sp = 0;
+    Array_space space {*table, pool, 0};
+    Error_code e = execute(code.data(), code.data()+code.size(), table->values(), stack, sp, stack+max_depth, &space);
+                                //an empty code runs nothing: sp stays 0, an incomplete_program
+    if (e != Error_code::none) return Result{0, Error{e, string_view()}};
+    if (sp != 1) return Result{0, Error{Error_code::incomplete_program, string_view()}};
+    if (arrays && kinds.back()) return finish_array(stack[0]);
+    return finish(stack[0]);
+}
+
+//---------------------------------------------------------------------------------------
+
+double Program::run() const
+{
+    Result r = try_run();
+    if (!r) error(r.error.message());
+    return r.value;
+}
+
+//---------------------------------------------------------------------------------------
+// reactive Symbol_tables
+
+//---------------------------------------------------------------------------------------
+
+void Symbol_table::define(int slot, const vector<Instruction>& code, int stack_size, int temps)
+{
+    auto f = make_shared<Formula>(Formula{code, stack_size, temps, {}});
+    for (const Instruction& in : code) {
+        if (in.op == Op::assign) return;          //running it again would assign again
+        if (in.op == Op::array_load || in.op == Op::make_array) return;     //only numbers are recomputed
+        if (in.op == Op::load && std::find(f->sources.begin(), f->sources.end(), in.slot) == f->sources.end())
+            f->sources.push_back(in.slot);
+    }
+    if (f->sources.empty()) return;               //a constant: nothing to recompute it for
+    for (int source : f->sources) dependents[source].push_back(slot);
+    formulas[slot] = f;
+}
+
+//---------------------------------------------------------------------------------------
+
+void Symbol_table::update(int slot)
+{
+    Phase_timer timer(Phase::eval);
+    //the variables that depend on slot, each after those it uses: the reverse of the order
+    //in which a depth-first search from slot finishes them
+    ++epoch;
+    visited[slot] = epoch;
+    vector<int> order;
+    vector<pair<int,int>> work {{slot,0}};      //(slot, number of its dependents seen)
+    while (!work.empty()) {
+        int s = work.back().first;
+        int i = work.back().second++;
+        if (i < dependents[s].size()) {
+            int d = dependents[s][i];
+            if (visited[d] != epoch) {
+                visited[d] = epoch;
+                work.push_back({d,0});
+            }
+        }
+        else {
+            order.push_back(s);
+            work.pop_back();
+        }
+    }
+
+    string failed;              //the first error. A variable whose formula fails keeps its value
+    vector<double> stack;
+    for (int k = int(order.size())-2; k>=0; --k) {   //the last one is slot
+        int s = order[k];
+        const Formula& f = *formulas[s];
+        stack.resize(f.stack_size+f.temps);
+        int sp = 0;
+        Error_code e = execute(f.code.data(), f.code.data()+f.code.size(), vals.data(), stack.data(), sp, stack.data()+f.stack_size);
+        if (e == Error_code::none) vals[s] = stack[0];
+        else if (failed.empty()) failed = string(names[s]) + ": " + Error{e, string_view()}.message();
+    }
+    if (!failed.empty()) error("set: ", failed);
+}
+
+//---------------------------------------------------------------------------------------
+
+bool Program::is_current() const
+{
+    for (int slot : captured)
+        if (!table->is_constant(slot)) return false;
+    return true;
+}
+
+//---------------------------------------------------------------------------------------
+
+Result Program::try_result() const
+{
+    if (live_depth != 1) return Result{0, Error{Error_code::incomplete_program, string_view()}};
+    if (arrays && kinds.back()) return finish_array(live[0]);
+    return finish(live[0]);
+}
+
+//---------------------------------------------------------------------------------------
+
+double Program::result() const
+{
+    Result r = try_result();
+    if (!r) error(r.error.message());
+    return r.value;
+}
+
+//---------------------------------------------------------------------------------------
+// the messages of the errors: the text before and after the name
+
+struct Error_text {
+    const char* before;
+    const char* after;
+};
+
+const Error_text error_texts[] = {     //by Error_code
+    {"", ""},
+    {"divide by zero", ""},
+    {"%: divide by zero", ""},
+    {"Can't take sqrt of negative number", ""},
+    {"Invalid narrowing conversion", ""},
+    {"Bad token", ""},
+    {"primary expected", ""},
+    {"'(' expected", ""},
+    {"')' expected", ""},
+    {"',' expected. Recall format for power is pow(x,i) is x^i.", ""},
+    {"name expected in declaration", ""},
+    {"= missing in declaration of ", ""},
+    {"", " declared twice"},
+    {"get: undefined name ", ""},
+    {"incomplete program", ""},
+    {"expression nested too deeply", ""},
+    {"number expected, not an array", ""},
+    {"array expected", ""},
+    {"arrays of different sizes", ""},
+    {"']' expected", ""},
+    {"can't assign to array ", ""}
+};
+
+string Error::message() const
+{
+    const Error_text& t = error_texts[int(code)];
+    return t.before + string(name) + t.after;
+}
+
+ostream& operator<<(ostream& os, const Error& e)
+{
+    const Error_text& t = error_texts[int(e.code)];
+    return os << t.before << e.name << t.after;
+}
+
+//-----------------------------------------------------------------------------
+//fail for a bad Token: a malformed one, or an assignment to an array (see Token_stream::get())
+static bool fail_bad(Program& prog, const Token& t)
+{
+    if (t.name.empty()) return prog.fail(Error_code::bad_token);
+    return prog.fail(Error_code::array_assigned, t.name);
+}
+
+//read a Token of kind, or fail with code (a bad Token fails as fail_bad())
+static bool expect(Token_stream &ts, Program& prog, char kind, Error_code code)
+{
+    Token t = ts.get();
+    if (t.kind == kind) return true;
+    if (t.kind == bad) return fail_bad(prog, t);
+    return prog.fail(code);
+}
+
+//-----------------------------------------------------------------------------
+// expression, term and primary, without recursion. Each rule is the loop of the recursive
+// version: the explicit stack holds where each rule that is under way goes on when the rule
+// it "called" returns. The code is emitted, and the tokens read, in exactly the order of the
+// recursive version, so an eager program fails at the same place.
+//
+//  Expression: Term { + Term | - Term }
+//  Term:       Primary { * Primary | / Primary | % Term }
+//  Primary:    Number | Name | ( Expression ) | - Primary | + Primary
+//              | sqrt ( Expression ) | pow ( Expression , Expression )
+//              | [ Expression { , Expression } ] | sum ( Expression ) | dot ( Expression , Expression )
+
+enum class Rule : char { none, expression, term, primary };
+
+enum Resume : unsigned char {     //the stack entries
+    expression_after_term,      //read + or -, or end the expression
+    expression_add,             //the right operand has been read
+    expression_subtract,
+    term_after_primary,         //read *, / or %, or end the term
+    term_multiply,
+    term_divide,
+    term_modulo,
+    primary_close,              //( Expression has been read
+    primary_negate,
+    primary_sqrt,
+    primary_pow_comma,          //pow ( Expression
+    primary_pow_close,          //pow ( Expression , Expression
+    primary_element,            //[ Expression { , Expression }: read , or ]
+    primary_sum,                //sum ( Expression
+    primary_min,
+    primary_max,
+    primary_mean,
+    primary_dot_comma,          //dot ( Expression
+    primary_dot_close           //dot ( Expression , Expression
+};
+
+static bool parse(Token_stream &ts, Program& prog, Rule rule)
+{
+    static thread_local vector<Resume> stack;     //reused: once it has grown, parsing doesn't allocate
+    static thread_local vector<int> elements;     //for each primary_element: the elements read so far
+    const size_t base = stack.size();
+    const size_t elements_base = elements.size();
+    const int limit = prog.nesting_limit();
+    int nesting = 0;                              //primary_* entries on the stack
+    auto nest = [&](Resume r) {
+        if (nesting == limit) return prog.fail(Error_code::too_deep);
+        ++nesting;
+        stack.push_back(r);
+        return true;
+    };
+    auto failed = [&] {        //leave the stacks as they were
+        stack.resize(base);
+        elements.resize(elements_base);
+        return false;
+    };
+
+    while (true) {
+        //start rule
+        switch (rule) {
+        case Rule::expression:
+            stack.push_back(expression_after_term);
+            rule = Rule::term;
+            continue;
+        case Rule::term:
+            stack.push_back(term_after_primary);
+            rule = Rule::primary;
+            continue;
+        case Rule::primary:
+        {   Token t = ts.get();
+            rule = Rule::none;
+            switch (t.kind) {
+            case '(':                    // handle '(' expression ')'
+                if (!nest(primary_close)) return failed();
+                rule = Rule::expression;
+                break;
+            case '-':                    //unitary - (i.e. if expression starts with -5)
+                if (!nest(primary_negate)) return failed();
+                rule = Rule::primary;
+                break;
+            case '+':                    //unitary +
+                rule = Rule::primary;
+                break;
+            case number:
+                if (!prog.emit(Op::number, 0, t.value)) return failed();     //push number's value
+                break;
+            case name:
+            {   const Symbol_table& st = prog.symbol_table();
+                int slot = st.find(t.name);
+                if (slot < 0 || !st.is_declared(slot)) {
+                    prog.fail(Error_code::undefined_name, t.name);
+                    return failed();
+                }
+                if (!prog.emit(Op::load, slot)) return failed();        //push variable's value
+                break;
+            }
+            case square_root:            //after sqrt should have '('
+                if (!expect(ts, prog, '(', Error_code::lparen_expected) || !nest(primary_sqrt)) return failed();
+                rule = Rule::expression;
+                break;
+            case power:                  //after pow should have '('
+                if (!expect(ts, prog, '(', Error_code::lparen_expected) || !nest(primary_pow_comma)) return failed();
+                rule = Rule::expression;
+                break;
+            case '[':                    //an array: at least one element
+                if (!nest(primary_element)) return failed();
+                elements.push_back(0);
+                rule = Rule::expression;
+                break;
+            case builtin:                //after sum, min, max, mean or dot should have '('
+            {   const Resume builtins[] = {primary_sum, primary_min, primary_max, primary_mean, primary_dot_comma};  //by Reduction
+                int k = 0;
+                while (t.name != builtin_keys[k]) ++k;
+                if (!expect(ts, prog, '(', Error_code::lparen_expected) || !nest(builtins[k])) return failed();
+                rule = Rule::expression;
+                break;
+            }
+            case bad:
+                fail_bad(prog, t);
+                return failed();
+            default:
+                prog.fail(Error_code::primary_expected);
+                return failed();
+            }
+            if (rule != Rule::none) continue;
+            break;
+        }
+        case Rule::none:
+            break;
+        }
+
+        //the rule has ended: go on with the one that started it
+        if (stack.size() == base) return true;
+        switch (stack.back()) {
+        case expression_after_term:
+        {   Token t = ts.get();
+            switch (t.kind) {
+            case '+':
+                stack.back() = expression_add;
+                rule = Rule::term;
+                break;
+            case '-':
+                stack.back() = expression_subtract;
+                rule = Rule::term;
+                break;
+            case bad:
+                fail_bad(prog, t);
+                return failed();
+            default:
+                ts.unget(t);       //if next character is not + or -, then previous thing is a term which we return.
+                stack.pop_back();
+            }
+            break;
+        }
+        case expression_add:
+            if (!prog.emit(Op::add)) return failed();
+            stack.back() = expression_after_term;
+            break;
+        case expression_subtract:
+            if (!prog.emit(Op::subtract)) return failed();
+            stack.back() = expression_after_term;
+            break;
+        case term_after_primary:
+        {   Token t = ts.get();
+            switch (t.kind) {
+            case '*':
+                stack.back() = term_multiply;
+                rule = Rule::primary;
+                break;
+            case '/':
+                stack.back() = term_divide;
+                rule = Rule::primary;
+                break;
+            case '%':                    //% requires int operators. left is checked before reading the right one.
+                if (!prog.emit(Op::to_int)) return failed();
+                stack.back() = term_modulo;
+                rule = Rule::term;
+                break;
+            case bad:
+                fail_bad(prog, t);
+                return failed();
+            default:                     //if char is non of the chars that would make this a term
+                ts.unget(t);
+                stack.pop_back();
+            }
+            break;
+        }
+        case term_multiply:
+            if (!prog.emit(Op::multiply)) return failed();
+            stack.back() = term_after_primary;
+            break;
+        case term_divide:
+            if (!prog.emit(Op::divide)) return failed();      //checks for divide by zero
+            stack.back() = term_after_primary;
+            break;
+        case term_modulo:
+            if (!prog.emit(Op::modulo)) return failed();
+            stack.back() = term_after_primary;
+            break;
+        case primary_close:
+            stack.pop_back();
+            --nesting;
+            if (!expect(ts, prog, ')', Error_code::rparen_expected)) return failed();
+            break;
+        case primary_negate:
+            stack.pop_back();
+            --nesting;
+            if (!prog.emit(Op::negate)) return failed();
+            break;
+        case primary_sqrt:
+            stack.pop_back();
+            --nesting;
+            if (!expect(ts, prog, ')', Error_code::rparen_expected) || !prog.emit(Op::square_root)) return failed();
+            break;
+        case primary_pow_comma:
+            if (!expect(ts, prog, ',', Error_code::comma_expected)) return failed();
+            stack.back() = primary_pow_close;
+            rule = Rule::expression;
+            break;
+        case primary_pow_close:
+            stack.pop_back();
+            --nesting;
+            if (!expect(ts, prog, ')', Error_code::rparen_expected) || !prog.emit(Op::power)) return failed();
+            break;
+        case primary_element:
+        {   ++elements.back();
+            Token t = ts.get();
+            if (t.kind == ',') {
+                rule = Rule::expression;
+                break;
+            }
+            if (t.kind != ']') {
+                if (t.kind == bad) fail_bad(prog, t);
+                else prog.fail(Error_code::rbracket_expected);
+                return failed();
+            }
+            stack.pop_back();
+            --nesting;
+            int n = elements.back();
+            elements.pop_back();
+            if (!prog.emit(Op::make_array, n)) return failed();
+            break;
+        }
+        case primary_sum:
+        case primary_min:
+        case primary_max:
+        case primary_mean:
+        {   Reduction r = Reduction(stack.back()-primary_sum);
+            stack.pop_back();
+            --nesting;
+            if (!expect(ts, prog, ')', Error_code::rparen_expected) || !prog.emit(Op::reduce, int(r))) return failed();
+            break;
+        }
+        case primary_dot_comma:
+            if (!expect(ts, prog, ',', Error_code::comma_expected)) return failed();
+            stack.back() = primary_dot_close;
+            rule = Rule::expression;
+            break;
+        case primary_dot_close:
+            stack.pop_back();
+            --nesting;
+            if (!expect(ts, prog, ')', Error_code::rparen_expected) || !prog.emit(Op::reduce, int(Reduction::dot))) return failed();
+            break;
+        }
+    }
 }
 
+//-----------------------------------------------------------------------------
+
+bool expression(Token_stream &ts, Program& prog) { return parse(ts, prog, Rule::expression); }    //deal with + and -
+bool term(Token_stream &ts, Program& prog) { return parse(ts, prog, Rule::term); }                //deal with *,/, and %
+bool primary(Token_stream &ts, Program& prog) { return parse(ts, prog, Rule::primary); }          //deal with numbers and parentheses
+
 //----------------------------------------------------------------------------------
 //handle: name =  expression
 //declare a variable called "name" with the initial value "expression"
 
-double declaration(Token_stream &ts)
+bool declaration(Token_stream &ts, Program& prog)
 {
 	Token t = ts.get();
-    if (t.kind != name) error ("name expected in declaration");
-	string name = t.name;
-	if (is_declared(name)) error(name, " declared twice");
+    if (t.kind == bad) return fail_bad(prog, t);
+    if (t.kind != name) return prog.fail(Error_code::name_expected);
+	Symbol_table& st = prog.symbol_table();
+	int slot = st.intern(t.name);      //t.name is only valid until the next get()
+	string_view name = st.name_of(slot);
+	if (st.is_declared(slot)) return prog.fail(Error_code::declared_twice, name);
 	Token t2 = ts.get();
-	if (t2.kind != '=') error("= missing in declaration of " ,name);
-    double d = expression(ts);
-    var_names.push_back(Variable(name,d));
-	return d;
+	if (t2.kind == bad) return fail_bad(prog, t2);
+	if (t2.kind != '=') return prog.fail(Error_code::equals_expected, name);
+    if (!expression(ts, prog)) return false;
+    prog.declare(slot);     //the variable is declared when the program has run without errors
+    return true;
 }
 
 //---------------------------------------------------------------------
 
-double statement(Token_stream &ts)                  //recognizes if is a declaration or expression
+bool statement(Token_stream &ts, Program& prog)                  //recognizes if is a declaration or expression
 {
 	Token t = ts.get();
 	switch(t.kind) {
 	case let:
-        return declaration(ts);
+        return declaration(ts, prog);
 	default:
 		ts.unget(t);
-        return expression(ts);
+        return expression(ts, prog);
 	}
 }
 
 //---------------------------------------------------------------------
 
-void clean_up_mess(Token_stream &ts)
+Result try_evaluate(Token_stream &ts, Program& prog)
 {
-	ts.ignore(print);
+    Phase_timer timer(Phase::parse);      //what isn't charged to the phases below
+    ts.set_target(&prog);   //prog also gets the assignments found while reading
+    if (!statement(ts, prog)) return Result{0, prog.last_error()};
+    if (prog.is_eager()) return prog.try_result();
+    if (!(prog.is_declaration() && prog.symbol_table().is_reactive())) optimize(prog);   //a formula must load the constants it uses
+    return prog.try_run();
 }
 
-//------------------------------------------------------------------
+//---------------------------------------------------------------------
 
+double evaluate(Token_stream &ts, Program& prog)
+{
+    Result r = try_evaluate(ts, prog);
+    if (!r) error(r.error.message());
+    return r.value;
+}
+
+//---------------------------------------------------------------------
 
-void calculate(Token_stream &ts)
+Calculator::Calculator()
+    : prog(table)
 {
-    while(true) try {       //while(true) will continue in the loop until reaches a break or return.
-		cout << prompt;
-		Token t = ts.get();
-        while (t.kind == print) t=ts.get();  //first eat all "print" statements
-        if (t.kind == quit) return;         //quit
-        ts.unget(t);
-        cout << result << statement(ts) << endl;
-	}
-	catch(runtime_error& e) {
-        cerr << "Error: " << e.what() << endl;
-        cerr << "Please re-enter your expression. If don't see the '>' prompt,  type ; followed by [Enter]" << endl;
-        clean_up_mess(ts);
-	}
+    // predefine names:
+    table.declare_constant("pi",3.1415926535);
+    table.declare_constant("e", 2.7182818284);
+    table.declare_constant("k", 1000);
+    prog.set_eager(true);      //run while compiling, so errors are found where they were before
 }
 
-//----------------------------------------------------------------------
+//---------------------------------------------------------------------
 
-int main()
+Result Calculator::try_evaluate(string_view statement)
+{
+    Statement_timer timer;
+    Result r;
+    {   Phase_timer parse(Phase::parse);
+        Program_cache::normalize(statement, key);
+        if (const Program* p = cache.find(key)) r = p->try_run();
+        else {
+            Token_stream ts(statement);
+            prog.clear();
+            r = ::try_evaluate(ts, prog);
+            if (r) cache.insert(key, prog);
+        }
+    }
+    timer.stop();
+    return r;
+}
 
-	try {
-        cout << "Welcome to our simple calculator." <<endl;
-        cout <<"Please enter expressions followed by  ; and [Enter] key to print the result. Scientific e notation (i.e. 1e2 = 100) can be used" <<endl;
-        cout <<"Operators +,-,*,/, %(for int) are avalable. Variables can be defined using 'let', i.e. let x = 5;" << endl;
-        cout << "Predefined types pi, e, and k = 1000 and functions sqrt(), pow(x,i) = x^i (x and i can be any expression) are also available." << endl;
-        cout << "To quit, use 'quit' followed by [Enter] key" << endl;
-        // predefine names:
-        var_names.push_back(Variable("pi",3.1415926535));
-        var_names.push_back(Variable("e", 2.7182818284));
-        var_names.push_back(Variable("k", 1000));
-        Token_stream ts;
-        calculate(ts);
-		return 0;
-	}
-	catch (exception& e) {
-		cerr << "exception: " << e.what() << endl;
-		return 1;
-	}
-	catch (...) {
-		cerr << "exception\n";
-		return 2;
-	}
+//---------------------------------------------------------------------
+
+double Calculator::evaluate(string_view statement)
+{
+    Result r = try_evaluate(statement);
+    if (!r) error(r.error.message());     //while the name in it, if any, is still valid
+    return r.value;
+}
 
+//---------------------------------------------------------------------
+
+bool Calculator::calculate(Token_stream& ts, ostream& os, ostream& errors, Output_format format)
+{
+    return ::calculate(ts, prog, os, errors, format);
+}
+
+//---------------------------------------------------------------------
+
+Result_writer::Result_writer(ostream& os, Output_format format, bool each)
+    : os(os), format(format), each(each), unflushed(false), n(0)
+{
+}
+
+void Result_writer::spill()
+{
+    os.write(buf, n);
+    n = 0;
+}
+
+void Result_writer::put(const char* p, size_t k)
+{
+    if (k > sizeof(buf)-n) spill();
+    if (k > sizeof(buf)) os.write(p, k);     //i.e. a message with a very long name
+    else {
+        memcpy(buf+n, p, k);
+        n += k;
+    }
+}
+
+void Result_writer::flush()
+{
+    if (!unflushed) return;
+    spill();
+    os.flush();
+    unflushed = false;
+}
+
+//---------------------------------------------------------------------
+
+void Result_writer::add(double d)
+{
+    const size_t longest = 64;              //"= " or "," and a double in any of the formats, and a newline
+    if (sizeof(buf)-n < longest) spill();
+    char* p = buf+n;
+    char* end = buf+sizeof(buf);
+    switch (format) {
+    case Output_format::text:
+        p = copy(result.begin(), result.end(), p);
+        p = to_chars(p, end, d, chars_format::general, 6).ptr;     //as printf("%g"), which is how cout prints it
+        *p++ = '\n';
+        break;
+    case Output_format::shortest:
+        p = copy(result.begin(), result.end(), p);
+        p = to_chars(p, end, d).ptr;
+        *p++ = '\n';
+        break;
+    case Output_format::csv:
+        p = to_chars(p, end, d).ptr;
+        *p++ = ',';
+        *p++ = '\n';
+        break;
+    case Output_format::binary:
+    {
+        Result_record r {d, 0, 0};
+        memcpy(p, &r, sizeof(r));
+        p += sizeof(r);
+        break;
+    }
+    }
+    n = p-buf;
+    unflushed = true;
+    if (each) flush();
+}
+
+void Result_writer::add(const vector<double>& array)
+{
+    if (format == Output_format::binary) {
+        Result_record r {numeric_limits<double>::quiet_NaN(), 0, int32_t(array.size())};
+        put(reinterpret_cast<const char*>(&r), sizeof(r));
+        for (double d : array) {
+            Result_record e {d, 0, 0};
+            put(reinterpret_cast<const char*>(&e), sizeof(e));
+        }
+    }
+    else {
+        bool csv = format == Output_format::csv;
+        if (csv) put("\"[", 2);
+        else {
+            put(result.data(), result.size());
+            put("[", 1);
+        }
+        const size_t longest = 32;          //", " and a double
+        char* end = buf+sizeof(buf);
+        for (size_t i = 0; i<array.size(); ++i) {
+            if (sizeof(buf)-n < longest) spill();
+            char* p = buf+n;
+            if (i > 0) {
+                *p++ = ',';
+                *p++ = ' ';
+            }
+            if (format == Output_format::text) p = to_chars(p, end, array[i], chars_format::general, 6).ptr;
+            else p = to_chars(p, end, array[i]).ptr;
+            n = p-buf;
+        }
+        if (csv) put("]\",\n", 4);
+        else put("]\n", 2);
+    }
+    unflushed = true;
+    if (each) flush();
+}
+
+void Result_writer::add(const Error& e)
+{
+    if (format == Output_format::csv) {
+        string row = ",\"";
+        for (char c : e.message()) {
+            if (c == '"') row += '"';       //a quote in a quoted field is doubled
+            row += c;
+        }
+        row += "\"\n";
+        put(row.data(), row.size());
+    }
+    else if (format == Output_format::binary) {
+        Result_record r {numeric_limits<double>::quiet_NaN(), int32_t(e.code), 0};
+        put(reinterpret_cast<const char*>(&r), sizeof(r));
+    }
+    else return;
+    unflushed = true;
+    if (each) flush();
+}
+
+//---------------------------------------------------------------------
+
+bool calculate(Token_stream& ts, Program& prog, ostream& os, ostream& errors, Output_format format)
+{
+    bool complete = true;   //false once the end of the input was found while skipping a failed statement
+    Result_writer out(os, format, ts.interactive());
+    bool prompting = ts.interactive() && (format == Output_format::text || format == Output_format::shortest);
+    ts.set_target(&prog);   //also for the first get() of a statement, which is before evaluate()
+    while(true) {           //while(true) will continue in the loop until reaches a break or return.
+        if (prompting) os << prompt;
+        Statement_timer timer;
+        prog.clear();
+        Token t = ts.get();
+        while (t.kind == print) t=ts.get();  //first eat all "print" statements
+        if (t.kind == quit) return complete;    //quit
+        ts.unget(t);
+        Result r = try_evaluate(ts, prog);   //before printing the result string, so an error isn't printed after it
+        if (r.array) out.add(*r.array);
+        else if (r) out.add(r.value);
+        else {
+            Phase_timer recovery(Phase::recovery);
+            stats_count(Counter::errors);
+            out.add(r.error);
+            out.flush();                                //the results before it come first, also if os and errors are one file
+            errors << "Error: " << r.error << endl;     //before reading on, which can make the name in it invalid
+            if (ts.interactive()) errors << "Please re-enter your expression. If don't see the '>' prompt,  type ; followed by [Enter]" << endl;
+            if (!ts.ignore(print)) complete = false;   //clean up the mess: skip the rest of the statement
+        }
+        timer.stop();
+    }
+}
@@ -0,0 +1,688 @@
+//
+// This is the interface of the simple calculator from Chapter 7 of
+// "Programming -- Principles and Practice Using C++" by Bjarne Stroustrup.
+// See calculator.cpp for the grammar and calculator_main.cpp for the program.
+//
+
+#ifndef CALCULATOR_H
+#define CALCULATOR_H
+
+#include "std_lib_facilities.h"
+#include <list>
+#include <memory>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+
+//-----------------------------------------------------------------------------------
+const char number = '8';        // t.kind==number means that t is a number Token
+const char quit   = 'q';        // t.kind==quit means that t is a quit Token
+const char print  = ';';        // t.kind==print means that t is a print Token
+const char name   = 'a';        // name token
+const char let    = 'L';        // declaration token
+const char square_root   = 's';  //square root token
+const char power = 'p';          //power token
+const char bad = 'b';            //a malformed token (i.e. "$" or "1e;"), or "name =" for an array (with its name): get() doesn't throw
+const char builtin = 'f';        //sum, min, max, mean or dot: the name is the keyword
+const string declkey = "let";   // declaration keyword
+const string quitkey = "quit";  //quit keyword
+const string prompt  = "> ";
+const string result  = "= ";    // used to indicate that what follows is a result
+const string sqrt_key    = "sqrt";  //square root keyword
+const string power_key = "pow";    //power keyword
+const string builtin_keys[] = {"sum", "min", "max", "mean", "dot"};    //by Reduction
+
+//-------------------------------------------------------------------------------
+
+struct Token {
+    char kind;          //kind of token
+    double value;       //value for numbers
+    string_view name;   //name for variables. Points into the input: only valid until the next get()
+    Token(char ch)             :kind{ch}, value{0} { }     //for operators/letters
+    Token(char ch, double val) :kind{ch}, value{val} { }   //for numbers
+    Token(char ch, string_view n) :kind{ch}, value{0}, name{n} { }     //for variables
+};
+
+//------------------------------------------------------------------------------------
+// The Token_stream reads from a buffer of characters, so a Token doesn't need its own copy of a name.
+// From an istream (i.e. cin), the buffer is the current line. From a file (see Input_file), it's the whole file.
+
+class Program;
+
+class Token_stream {
+public:
+    Token_stream()     //reads from cin, a line at a time
+        :  full(false), buffer(0), target(nullptr), cur(nullptr), last(nullptr), in(&cin) { }
+    explicit Token_stream(istream& is)     //reads from is, a line at a time
+        :  full(false), buffer(0), target(nullptr), cur(nullptr), last(nullptr), in(&is) { }
+    Token_stream(string_view text)     //reads text, which must outlive the Token_stream
+        :  full(false), buffer(0), target(nullptr), cur(text.data()), last(text.data()+text.size()), in(nullptr) { }
+    Token get();                                   //get a Token. At the end of the input, get() returns quit
+    void unget(Token t);    //put the got Token back. Token t is stored in buffer.
+    bool ignore(char c);   //discard tokens up to and including a particular char. Used for clean_up_mess() after an error occurs. False if there was no c
+    void set_target(Program* p) { target = p; }   //program that gets the assignments "name = value" read by get()
+    bool interactive() const { return in == &cin; }
+    bool at_end() { return !full && !more(); }     //no more tokens. From an istream, waits for more input
+private:
+    bool full;            //is there a Token in the buffer?
+    Token buffer;         //keep Token put back using unget() here
+    Program* target;      //if null, assignments are done right away, to symbols
+    const char* cur;      //next character to read
+    const char* last;     //end of the characters read so far
+    istream* in;          //null if reading text
+    string line;          //the current line from in
+    string name_buf;      //keeps a name from the current line while the next line is read
+    bool more();          //skip whitespace, reading more lines from in if needed. False at the end of the input
+};
+
+//------------------------------------------------------------------------------------
+
+const char* read_number(const char* p, const char* last, double& val);   //read a floating-point-literal, return the position after it,
+                                                                         //or nullptr if it's malformed (i.e. just a .)
+
+//------------------------------------------------------------------------------------
+
+class Input_file {      //the contents of a file, memory mapped where the system can do that
+public:
+    explicit Input_file(const string& path);
+    ~Input_file();
+    string_view text() const { return string_view(data, size); }
+private:
+    const char* data;
+    size_t size;
+    bool mapped;
+    string contents;      //if not mapped
+    Input_file(const Input_file&) = delete;
+    Input_file& operator=(const Input_file&) = delete;
+};
+
+//--------------------------------------------------------------------------------------------
+// An Arena hands out memory from a few big blocks, and frees all of it at once. The names of
+// a Symbol_table live in its Arena, and optimize() builds its graph in one that is reset for
+// each statement, so neither goes to the allocator for every small piece.
+
+class Arena {
+public:
+    explicit Arena(size_t block_size = 4096)
+        : first(nullptr), current(nullptr), cur(nullptr), end(nullptr), block_size(block_size) { }
+    ~Arena();
+    void* allocate(size_t n, size_t align = alignof(max_align_t));
+    string_view copy(string_view s);      //a copy of s, in the arena
+    void reset();                         //free everything at once. The blocks are kept for reuse
+private:
+    struct Block {
+        Block* next;
+        size_t size;                      //of the memory that follows the Block
+    };
+    Block* first;
+    Block* current;                       //the block allocate() takes memory from
+    char* cur;                            //free memory of current
+    char* end;
+    size_t block_size;
+    void next_block(size_t n, size_t align);   //make the next block (that can take n bytes) current
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+};
+
+template<class T> struct Arena_allocator {      //for standard containers: memory comes from the arena, deallocate() does nothing
+    using value_type = T;
+    Arena* arena;
+    Arena_allocator(Arena& a) : arena(&a) { }
+    template<class U> Arena_allocator(const Arena_allocator<U>& a) : arena(a.arena) { }
+    T* allocate(size_t n) { return static_cast<T*>(arena->allocate(n*sizeof(T), alignof(T))); }
+    void deallocate(T*, size_t) { }
+};
+
+template<class T, class U> bool operator==(const Arena_allocator<T>& a, const Arena_allocator<U>& b) { return a.arena == b.arena; }
+template<class T, class U> bool operator!=(const Arena_allocator<T>& a, const Arena_allocator<U>& b) { return a.arena != b.arena; }
+
+//--------------------------------------------------------------------------------------------
+
+// The variables. A name is interned once and gets a slot: an index into a dense array
+// of values. The compiled code refers to variables by slot only, so running a Program
+// doesn't hash or compare names.
+// Each Calculator has its own Symbol_table. The global symbols are the variables of
+// everything else, i.e. of the code that compiles Programs without a Calculator.
+// A reactive Symbol_table works like a spreadsheet: it keeps the code of each "let", and
+// set_value() recomputes the variables computed from the one it sets, each after those it
+// uses. Only the variables that depend on it are visited. Assignments in statements
+// ("x = 2") don't recompute anything.
+
+struct Instruction;
+struct Formula;
+
+class Symbol_table {
+public:
+    Symbol_table() : index(16, -1), reactive(false), epoch(0) { }
+    Symbol_table(const Symbol_table& st);               //copies the names into its own arena
+    Symbol_table& operator=(const Symbol_table& st);
+    int find(string_view s) const;       //slot of s, -1 if s was never interned
+    int intern(string_view s);           //slot of s, a new (undeclared) slot if s wasn't seen before
+    bool is_declared(int slot) const { return declared[slot]; }
+    bool is_declared(string_view s) const;              //check is variable is already declared
+    int get_slot(string_view s) const;                  //slot of declared variable s
+    void set_value(string_view s, double d);            //set the value of variable named s to d, and recompute what depends on it if reactive
+    void declare(int slot, double d) { declared[slot] = true; vals[slot] = d; }
+    void declare(string_view s, double d) { declare(intern(s), d); }   //i.e. for the predefined names
+    void declare_array(int slot, const vector<double>& elements);      //an array variable: can't be assigned or be a number again
+    bool is_array(int slot) const { return !arrays[slot].empty(); }
+    const vector<double>& array(int slot) const { return arrays[slot]; }
+    void declare_constant(string_view s, double d);    //like declare(), and optimize() may use the value
+    bool is_constant(int slot) const { return constant[slot]; }
+    void mark_assigned(int slot) { constant[slot] = false; }      //a constant that is assigned isn't one any more
+    string_view name_of(int slot) const { return names[slot]; }
+    double value(int slot) const { return vals[slot]; }
+    void set(int slot, double d) { vals[slot] = d; constant[slot] = false; }
+    double* values() { return vals.data(); }   //moves when a new name is interned
+    const double* values() const { return vals.data(); }
+    int size() const { return names.size(); }
+    void set_reactive(bool b) { reactive = b; }
+    bool is_reactive() const { return reactive; }
+    void define(int slot, const vector<Instruction>& code, int stack_size, int temps);   //slot was declared as the result of code
+private:
+    Arena name_store;           //the characters of the names
+    vector<string_view> names;  //by slot, into name_store
+    vector<size_t> hashes;      //by slot, hash of the name
+    vector<double> vals;        //by slot
+    vector<vector<double>> arrays;   //by slot, the elements of an array variable; empty for a number
+    vector<char> declared;      //by slot. A declaration that failed leaves its slot undeclared
+    vector<char> constant;      //by slot. A predefined name that hasn't been assigned
+    vector<int> index;          //open addressing hash table of slots, -1 for an empty entry
+    bool reactive;
+    vector<shared_ptr<const Formula>> formulas;     //by slot, null if the value isn't computed from other variables
+    vector<vector<int>> dependents;                 //by slot, the slots whose formulas use it
+    vector<unsigned> visited;   //by slot, the epoch of the last update() that found it
+    unsigned epoch;
+    static size_t hash(string_view s);
+    void insert(int slot);      //put slot into index
+    void update(int slot);      //recompute the variables that depend on slot
+};
+
+extern Symbol_table symbols;    //store names of variables
+
+int get_slot(string_view s);                //the same, for symbols
+void set_value(string_view s, double d);
+bool is_declared(string_view s);
+
+//------------------------------------------------------------------------------------------
+// Errors in a statement. Token_stream::get(), the grammar functions and running a Program
+// don't throw: in some input most lines are bad, and a throw costs microseconds. They report
+// an Error_code, and the name it's about, if any; the message is only made when it's printed.
+// The functions that return a plain double (evaluate(), Program::run(), ...) still throw a
+// runtime_error with the message.
+
+enum class Error_code : unsigned char {
+    none,
+    divide_by_zero,         //the errors of running a Program, also those of a row of a Batch and of a Jit_program
+    modulo_by_zero,
+    negative_sqrt,
+    not_int,
+    bad_token,              //the errors of reading a statement
+    primary_expected,
+    lparen_expected,
+    rparen_expected,
+    comma_expected,
+    name_expected,
+    equals_expected,        //"= missing in declaration of name"
+    declared_twice,         //"name declared twice"
+    undefined_name,         //"get: undefined name name"
+    incomplete_program,
+    too_deep,               //more nesting than Program::nesting_limit()
+    number_expected,        //an array where only a number will do (i.e. in %)
+    array_expected,         //a number where only an array will do (i.e. in sum())
+    size_mismatch,          //an operation on two arrays of different sizes
+    rbracket_expected,
+    array_assigned          //"name = value" for an array name
+};
+
+struct Error {
+    Error_code code;
+    string_view name;       //the name the message is about, if any. In the input or a Symbol_table: only valid until the next get()
+    string message() const;
+};
+
+ostream& operator<<(ostream& os, const Error& e);    //writes the message, without making a string
+
+struct Result {             //a value or an Error, like std::expected<double,Error>
+    double value;           //NaN if the value is an array
+    Error error;
+    const vector<double>* array = nullptr;      //the elements, if the value is an array: valid until the Program runs again
+    explicit operator bool() const { return error.code == Error_code::none; }
+};
+
+//------------------------------------------------------------------------------------------
+// A statement is compiled once into a Program: the instructions of a small stack
+// machine in postfix order. Running a Program only dispatches instructions, so
+// the same formula can be evaluated again (i.e. after changing a variable) without
+// reading and parsing it again.
+// An eager Program also runs each instruction as it is emitted. The interactive
+// calculator uses that, so an error (i.e. divide by zero) stops the reading of
+// the input at the same place as when the grammar functions evaluated directly.
+// A Program refers to variables by slot, so it belongs to one Symbol_table: symbols,
+// unless it's constructed with another one.
+// The grammar functions keep their own stack, not the machine's (see calculator.cpp), so a
+// statement can be nested as deeply as the nesting limit of its Program allows.
+// emit() knows which stack entries will be arrays: it emits the array form of an operation on
+// one (see Arrays below), and fails with number_expected or array_expected where the type is wrong.
+
+enum class Op : char {
+    number,        // push value
+    load,          // push value of variable slot
+    assign,        // variable slot = value (from "name = value", see Token_stream::get())
+    negate,        // unary -
+    add,
+    subtract,
+    multiply,
+    divide,
+    to_int,        // check that the left operand of % is an int
+    modulo,
+    int_modulo,    // % of operands that optimize() found to be ints: no checks
+    square_root,
+    power,
+    save,          // temporary slot = top of the stack, which stays (see optimize())
+    restore,       // push temporary slot
+    make_array,    // an array of the slot numbers on top of the stack (see Arrays below)
+    array_load,    // push array variable slot
+    array_op,      // an operation on arrays, element by element: slot is array_operation()
+    reduce         // an array to a number: slot is the Reduction
+};
+
+struct Instruction {
+    Op op;
+    int slot;          //variable for load and assign, temporary for save and restore
+    double value;      //value for number and assign
+};
+
+const int default_nesting_limit = 1<<20;     //levels of (), sqrt(), pow() and unary - in one statement
+
+class Program {
+public:
+    Program() : Program(symbols) { }
+    explicit Program(Symbol_table& st)
+        : table(&st), arrays(false), pool_used(0), decl_slot(-1), eager(false), depth(0), max_depth(0), temps(0), live_depth(0), err{},
+          max_nesting(default_nesting_limit) { }
+    Symbol_table& symbol_table() const { return *table; }
+    void clear();                                   //forget the code, to compile another statement
+    void set_eager(bool b) { eager = b; }           //run each instruction as soon as it is emitted
+    bool is_eager() const { return eager; }
+    void set_nesting_limit(int n) { max_nesting = n; }     //deeper statements fail with Error_code::too_deep
+    int nesting_limit() const { return max_nesting; }
+    bool emit(Op op, int slot = 0, double value = 0);    //false if an eager program failed to run it
+    void declare(int slot) { decl_slot = slot; }    //running the program declares variable slot with the result
+    bool fail(Error_code code, string_view name = string_view()) { err = Error{code, name}; return false; }
+    const Error& last_error() const { return err; }  //why compiling (or running, if eager) the statement failed
+    Result try_run() const;         //evaluate the program against its Symbol_table
+    Result try_result() const;      //result of an eager program, computed while it was compiled
+    double run() const;             //the same, throw runtime_error on errors
+    double result() const;
+    int size() const { return code.size(); }
+    const vector<Instruction>& instructions() const { return code; }
+    int stack_size() const { return max_depth; }    //stack entries needed to run the program
+    int temp_count() const { return temps; }        //temporaries needed to run the program
+    bool is_declaration() const { return decl_slot >= 0; }
+    int declared_slot() const { return decl_slot; }
+    void capture(int slot) { captured.push_back(slot); }   //the code uses the value of constant slot
+    bool is_current() const;        //false if a constant the code uses has been assigned since
+    bool has_arrays() const { return arrays; }     //some of the code works on arrays
+    size_t pool_bytes() const;      //memory of the arrays the code has computed, kept for the next run
+private:
+    Symbol_table* table;            //the variables
+    vector<Instruction> code;
+    vector<char> kinds;             //once arrays is set, for each stack entry after the code emitted so far: is it an array?
+    bool arrays;                    //the code has array instructions
+    mutable vector<vector<double>> pool;    //the arrays computed by the code, by handle (see Array_space)
+    mutable int pool_used;
+    int decl_slot;                  //-1 if not a declaration
+    bool eager;
+    int depth;                      //stack depth after the code emitted so far
+    int max_depth;                  //largest stack depth needed to run the code
+    int temps;                      //number of temporaries
+    vector<int> captured;           //constants whose values are in the code
+    vector<double> live;            //stack of an eager program
+    int live_depth;
+    Error err;
+    int max_nesting;
+    Result finish(double d) const;  //does the declaration, if any
+    Result finish_array(double handle) const;
+    bool check_types(Op& op, int& slot);    //the array form of op, or false if its operands can't be what they are
+};
+
+//------------------------------------------------------------------------------------------
+// Arrays (calculator_array.cpp). [1, 2, 3] is an array, and "let v = [1, 2, 3]" makes v an
+// array variable, which can't be assigned. + - * / pow() and sqrt() work element by element:
+// on two arrays of the same size, or on an array and a number (the number with each element).
+// sum(), min(), max() and mean() of an array, and dot() of two, are numbers. Each operation
+// is one loop over the elements (with SSE2 or AVX, where the machine has them), not an instruction each.
+// On the stack of the machine an array is a handle: a temporary array of the Program if it's
+// 0 or more, array variable -handle-1 if it's less than 0.
+
+enum class Reduction : char { sum, min, max, mean, dot };
+
+enum class Operands : char { arrays, number_array, array_number };   //of a binary array_op
+
+int array_operation(Op op, Operands kinds = Operands::arrays);       //the slot of an array_op for op
+
+struct Array_space {                    //where the array instructions find their arrays
+    const Symbol_table& table;          //the array variables
+    vector<vector<double>>& pool;       //the temporaries, by handle. Reused: the vectors keep their capacity
+    int used;                           //entries of pool in use
+};
+
+Error_code execute_array(const Instruction& in, double* stack, int& sp, Array_space& space);   //run an array instruction
+
+//------------------------------------------------------------------------------------------
+// the grammar: each function reads its part of a statement from ts and emits the code for it.
+// False if there was an error: then it's prog.last_error(), and the rest of the statement is unread
+
+bool expression(Token_stream& ts, Program& prog);
+bool term(Token_stream& ts, Program& prog);
+bool primary(Token_stream& ts, Program& prog);
+bool declaration(Token_stream& ts, Program& prog);
+bool statement(Token_stream& ts, Program& prog);
+
+Result try_evaluate(Token_stream& ts, Program& prog);   //compile the next statement into prog and run it (or take its result, if prog is eager)
+double evaluate(Token_stream& ts, Program& prog);       //the same, throw runtime_error on errors
+//------------------------------------------------------------------------------------------
+// How calculate() prints its results. text is a line "= value" per result, with 6 significant
+// digits, as cout prints a double by default; shortest is the same with the fewest digits that
+// read back as the same double. csv is a line per statement, "value," or ",\"message\"", so a
+// statement that failed has its row too; binary is a Result_record per statement. In each of
+// them, the errors also go to the errors stream, as in text. An array is "= [1, 2, 3]" in text,
+// "\"[1, 2, 3]\"," in csv.
+// A Result_writer formats the results into its buffer (with to_chars(), so no locale and no
+// stream state) and writes the buffer to os when it's full, not a flush per line. Interactive
+// input still gets each result at once.
+
+enum class Output_format { text, shortest, csv, binary };
+
+struct Result_record {      //binary: in the byte order and double format of the machine
+    double value;           //NaN if the statement failed or its value is an array
+    int32_t error;          //its Error_code, 0 if none
+    int32_t elements;       //of an array: a record for each follows, with the element as its value
+};
+
+class Result_writer {
+public:
+    Result_writer(ostream& os, Output_format format, bool each = false);   //each: write and flush each result
+    ~Result_writer() { flush(); }
+    void add(double d);             //the result of a statement
+    void add(const vector<double>& array);
+    void add(const Error& e);       //a statement that failed: a row in csv and binary, nothing in text
+    void flush();                   //write what's buffered and flush os; nothing if nothing was added since
+private:
+    ostream& os;
+    Output_format format;
+    bool each;
+    bool unflushed;                 //added since the last flush()
+    size_t n;                       //used in buf
+    char buf[1<<14];
+    void put(const char* p, size_t k);
+    void spill();                   //write buf to os, without flushing it
+    Result_writer(const Result_writer&) = delete;
+    Result_writer& operator=(const Result_writer&) = delete;
+};
+
+bool calculate(Token_stream& ts, Program& prog, ostream& os, ostream& errors, Output_format format = Output_format::text);
+                        //statements until quit, printing the results.
+                        //False if the input ended while skipping the rest of a failed statement
+
+//------------------------------------------------------------------------------------------
+// The optimizer (calculator_optimize.cpp) rewrites a compiled Program so that it does only the
+// unique work of the statement: constant subexpressions (also with the predefined constants
+// pi, e and k, until they are assigned) are computed once while optimizing, x*1, x/1, x-0,
+// x+0 and pow(x,2) are simplified, and a subexpression that occurs more than once is computed
+// once and then kept in a temporary. Operations that would fail are left for run() to report.
+// It also finds the subexpressions that are always integers (from integer literals, % and the
+// int check of %, with + - * that can't go past 2^53): an int check of one of those is dropped,
+// and a % of two of them becomes int_modulo, which doesn't check its operands again.
+
+void optimize(Program& prog, bool exact = false);   //exact: leave pow(x,2), so no result changes at all
+
+//------------------------------------------------------------------------------------------
+// A Program_cache (calculator_cache.cpp) keeps the compiled Programs of recently used statements,
+// found by their normalized text: the text without the spaces that don't separate tokens. So a
+// statement that comes again is only run, not read and parsed. When the Programs use more memory
+// than the limit, the least recently used ones are dropped. A Program that used the value of a
+// constant that has been assigned since (see Program::is_current()) is dropped when it's found.
+// Declarations and statements with assignments are not kept: running them again isn't the same.
+
+struct Cache_stats {
+    long hits;
+    long misses;
+    long evictions;         //dropped for the memory limit
+    long invalidations;     //dropped because a constant they used was assigned
+    size_t bytes;           //memory used by the cached Programs, about
+    int entries;
+};
+
+class Program_cache {
+public:
+    explicit Program_cache(size_t limit = 1<<20)     //limit in bytes, 0 to keep nothing
+        : limit(limit), stats_ {0, 0, 0, 0, 0, 0} { }
+    static void normalize(string_view text, string& key);    //key = the text of a statement, normalized
+    const Program* find(string_view key);          //null if it isn't kept, or isn't current
+    void insert(string_view key, const Program& prog);   //keeps an (exactly) optimized copy of prog, if it can be run again
+    void set_limit(size_t bytes);
+    void clear();
+    Cache_stats stats() const { return stats_; }
+private:
+    struct Entry {
+        string key;
+        Program prog;
+        size_t bytes;
+    };
+    list<Entry> entries;                           //the most recently used first
+    unordered_map<string_view,list<Entry>::iterator> index;    //by key, which is in the Entry
+    size_t limit;
+    Cache_stats stats_;
+    void erase(list<Entry>::iterator p);
+    void shrink();                                 //drop the least recently used Programs until under the limit
+};
+
+//------------------------------------------------------------------------------------------
+// A Calculator is one calculator session: its own variables (pi, e and k predefined) and the
+// Program it compiles statements into. Calculators share nothing, so independent sessions
+// can run on different threads at the same time without locks.
+// run_script() (calculator_parallel.cpp) runs the statements of a script that don't use each
+// other's variables at the same time, on threads (0: one per core), and prints what calculate()
+// would print, in the same order. With a reactive Symbol_table it runs them one after the other.
+
+class Calculator {
+public:
+    Calculator();
+    Result try_evaluate(string_view statement);    //compile (or find in programs()) and run one statement
+    double evaluate(string_view statement);        //the same, throw runtime_error on errors
+    bool calculate(Token_stream& ts, ostream& os, ostream& errors, Output_format format = Output_format::text);   //statements until quit, printing the results (see ::calculate())
+    void run_script(string_view text, ostream& os, ostream& errors, int threads = 0,
+                    Output_format format = Output_format::text);   //like calculate(), independent statements in parallel
+    Symbol_table& variables() { return table; }
+    Program_cache& programs() { return cache; }
+    void set_nesting_limit(int n) { prog.set_nesting_limit(n); }
+private:
+    Symbol_table table;
+    Program prog;               //reused for every statement
+    Program_cache cache;        //for evaluate()
+    string key;                 //normalized statement, reused
+    Calculator(const Calculator&) = delete;      //prog refers to table
+    Calculator& operator=(const Calculator&) = delete;
+};
+
+//------------------------------------------------------------------------------------------
+// Server mode (calculator_server.cpp): a Server listens on a Unix domain socket, and each
+// connection is a session with its own Calculator, so its variables are its own. A client can
+// send many statements in one write: the server runs all the complete ones (up to the last ';')
+// and sends their results in one write, a line per statement as calculate() prints them:
+// "= value" or "Error: message". "quit;", "quit" and a newline, or the end of the client's input
+// ends the session.
+// One thread serves all connections.
+
+class Server {
+public:
+    explicit Server(const string& path);    //listen on path; an old socket there is removed
+    ~Server();
+    void run();                             //serve until stop()
+    void stop();                            //from another thread, or a signal handler
+private:
+    string path;
+    int listen_fd;
+    int wake[2];                            //a pipe: stop() writes to it to wake run()
+    void close_all();                       //the descriptors that are open, also of a constructor that failed
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+};
+
+//------------------------------------------------------------------------------------------
+// Statistics (calculator_stats.cpp): counters, and the time spent in each phase of a statement.
+// They are only compiled in with -DCALC_STATS; otherwise Phase_timer, Statement_timer and
+// stats_count() are empty inline functions, so the calculator is exactly as fast as without them.
+// Time is charged to one phase at a time: a name looked up while lexing ("x = 2") is lookup
+// time, not lex time. Waiting for input is a phase of its own, and not part of any statement.
+// Each thread counts into its own record; stats_snapshot() adds them up.
+
+enum class Phase : char { none, input, lex, parse, lookup, eval, recovery };   //none: outside the calculator, or printing
+const int number_of_phases = 7;
+
+enum class Counter : char {
+    statements,
+    tokens,             //read from the input, not from the buffer of the Token_stream
+    lookups,            //of names in a Symbol_table
+    errors              //statements that failed in calculate()
+};
+const int number_of_counters = 4;
+
+const int latency_buckets = 48;     //bucket i: statements that took [2^i,2^(i+1)) ticks
+
+struct Stats {
+    bool enabled;                           //false if not compiled in: then everything is 0
+    long counters[number_of_counters];      //by Counter
+    double seconds[number_of_phases];       //by Phase
+    long latency[latency_buckets];          //statements by how long they took, without waiting for input
+    double ticks_per_second;
+    long count(Counter c) const { return counters[int(c)]; }
+    double time(Phase p) const { return seconds[int(p)]; }
+    double percentile(double p) const;      //seconds that p% of the statements took at most, about
+};
+
+Stats stats_snapshot();         //the totals of all threads, since the start or the last reset_stats()
+void reset_stats();
+void print_stats(ostream& os, const Stats& s);
+
+#ifdef CALC_STATS
+
+#include <atomic>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+inline long long stats_ticks() { return __rdtsc(); }      //a few ns, where a clock call takes 20
+#else
+inline long long stats_ticks() { return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count(); }
+#endif
+
+struct Thread_stats {           //the record of one thread. Others only read it, so its counters need no locked instructions
+    atomic<long> counters[number_of_counters];
+    atomic<long long> ticks[number_of_phases];
+    atomic<long> latency[latency_buckets];
+    Phase current;
+    long long since;            //when current began
+    Thread_stats();             //registers the record, for stats_snapshot()
+    ~Thread_stats();            //adds it to the totals of the threads that have ended
+};
+
+extern thread_local Thread_stats thread_stats;
+
+template<class T> inline void stats_add(atomic<T>& a, T n) { a.store(a.load(memory_order_relaxed)+n, memory_order_relaxed); }
+
+inline void stats_count(Counter c, long n = 1) { stats_add(thread_stats.counters[int(c)], n); }
+
+inline Phase switch_phase(Phase p)      //charge the time since the last switch to the current phase, make p current
+{
+    Thread_stats& t = thread_stats;
+    long long now = stats_ticks();
+    stats_add(t.ticks[int(t.current)], now-t.since);
+    t.since = now;
+    Phase old = t.current;
+    t.current = p;
+    return old;
+}
+
+class Phase_timer {             //the time until it's destroyed is charged to p, then the phase before goes on
+public:
+    explicit Phase_timer(Phase p) : saved(switch_phase(p)) { }
+    ~Phase_timer() { switch_phase(saved); }
+private:
+    Phase saved;
+    Phase_timer(const Phase_timer&) = delete;
+    Phase_timer& operator=(const Phase_timer&) = delete;
+};
+
+class Statement_timer {         //stop() counts a statement and its latency: the ticks charged to lex...recovery since the start
+public:
+    Statement_timer() : start(busy()) { }
+    void stop();
+private:
+    long long start;
+    static long long busy();
+};
+
+#else
+
+inline void stats_count(Counter, long = 1) { }
+
+class Phase_timer {
+public:
+    explicit Phase_timer(Phase) { }
+};
+
+class Statement_timer {
+public:
+    Statement_timer() { }
+    void stop() { }
+};
+
+#endif
+
+//------------------------------------------------------------------------------------------
+// Batch evaluation (calculator_batch.cpp): run one compiled expression over many rows.
+// A variable can be bound to a column, an array with a value for each row; the others
+// keep their value in the Symbol_table of the Program. Rows are done a block at a time, each instruction over a
+// whole block, so the arithmetic runs as SIMD loops.
+// A row that would have failed doesn't throw: it gets the Error_code Program::run() would
+// have failed with (Error{code}.message() is its message) and a NaN result.
+
+class Batch {
+public:
+    explicit Batch(const Program& p);                 //copies the code of p
+    void bind(int slot, const double* column);        //the variable in slot reads column[row]
+    int run(int rows, double* results, Error_code* errors) const;  //returns the number of rows with errors
+private:
+    const Symbol_table* table;                        //of the program: the values of the variables that aren't bound
+    vector<Instruction> code;
+    int depth;
+    int temps;
+    vector<const double*> columns;                    //by slot, null if not bound
+};
+
+//------------------------------------------------------------------------------------------
+// Native code (calculator_jit.cpp): on x86-64, a Jit_program translates the instructions of a
+// Program into straight-line SSE2 code once; run() then calls that code. The results and the
+// errors are the same as those of Program::run(). Where the JIT isn't available (another
+// machine, or a program it doesn't handle) run() uses the interpreter.
+
+class Jit_program {
+public:
+    explicit Jit_program(const Program& p);
+    ~Jit_program();
+    bool native() const { return fn != nullptr; }     //false if run() uses the interpreter
+    double run() const;
+private:
+    Program prog;                                   //for the interpreter
+    void* mem;                                      //the machine code
+    size_t mem_size;
+    int (*fn)(double* vars, double* result);        //returns 0, or the Error_code of the error
+    Jit_program(const Jit_program&) = delete;
+    Jit_program& operator=(const Jit_program&) = delete;
+};
+
+//------------------------------------------------------------------------------------------
+
+#endif // CALCULATOR_H
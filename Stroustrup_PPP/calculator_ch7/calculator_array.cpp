@@ -0,0 +1,391 @@
+//
+// Arrays for the simple calculator: the array instructions of a Program. See Arrays in calculator.h.
+//
+// The interpreter loop of Program::run() dispatches once per instruction, and an array
+// instruction is a single call here: each one is a loop over all the elements.
+// +,-,*,/ and sqrt use SIMD intrinsics, four elements at a time with AVX and two with SSE2,
+// so each element costs a fraction of an instruction instead of a pass of the interpreter.
+// A temporary array is a vector of the Program's pool, reused by the next run, so running
+// a compiled Program again doesn't allocate once the pool has grown.
+// Build with -O2 or -O3; with -mavx2 (or -march=native) the kernels use 256 bit registers.
+//
+
+#include "calculator.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+//------------------------------------------------------------------------------
+// the SIMD registers: Vec holds lanes doubles
+
+#if defined(__AVX__)
+typedef __m256d Vec;
+const int lanes = 4;
+static inline Vec load(const double* p) { return _mm256_loadu_pd(p); }
+static inline void store(double* p, Vec v) { _mm256_storeu_pd(p, v); }
+static inline Vec broadcast(double d) { return _mm256_set1_pd(d); }
+static inline Vec add(Vec a, Vec b) { return _mm256_add_pd(a, b); }
+static inline Vec subtract(Vec a, Vec b) { return _mm256_sub_pd(a, b); }
+static inline Vec multiply(Vec a, Vec b) { return _mm256_mul_pd(a, b); }
+static inline Vec divide(Vec a, Vec b) { return _mm256_div_pd(a, b); }
+static inline Vec roots(Vec a) { return _mm256_sqrt_pd(a); }
+static inline Vec minimum(Vec a, Vec b) { return _mm256_min_pd(a, b); }
+static inline Vec maximum(Vec a, Vec b) { return _mm256_max_pd(a, b); }
+static inline Vec flip_sign(Vec a) { return _mm256_xor_pd(a, _mm256_set1_pd(-0.0)); }     //flips the sign bit, as -x does
+static inline Vec is_equal(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }       //each lane all 1s or all 0s
+static inline Vec is_less(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+static inline Vec is_nan(Vec a) { return _mm256_cmp_pd(a, a, _CMP_UNORD_Q); }
+static inline Vec either(Vec a, Vec b) { return _mm256_or_pd(a, b); }
+static inline bool any(Vec mask) { return _mm256_movemask_pd(mask) != 0; }
+#elif defined(__SSE2__)
+typedef __m128d Vec;
+const int lanes = 2;
+static inline Vec load(const double* p) { return _mm_loadu_pd(p); }
+static inline void store(double* p, Vec v) { _mm_storeu_pd(p, v); }
+static inline Vec broadcast(double d) { return _mm_set1_pd(d); }
+static inline Vec add(Vec a, Vec b) { return _mm_add_pd(a, b); }
+static inline Vec subtract(Vec a, Vec b) { return _mm_sub_pd(a, b); }
+static inline Vec multiply(Vec a, Vec b) { return _mm_mul_pd(a, b); }
+static inline Vec divide(Vec a, Vec b) { return _mm_div_pd(a, b); }
+static inline Vec roots(Vec a) { return _mm_sqrt_pd(a); }
+static inline Vec minimum(Vec a, Vec b) { return _mm_min_pd(a, b); }
+static inline Vec maximum(Vec a, Vec b) { return _mm_max_pd(a, b); }
+static inline Vec flip_sign(Vec a) { return _mm_xor_pd(a, _mm_set1_pd(-0.0)); }
+static inline Vec is_equal(Vec a, Vec b) { return _mm_cmpeq_pd(a, b); }
+static inline Vec is_less(Vec a, Vec b) { return _mm_cmplt_pd(a, b); }
+static inline Vec is_nan(Vec a) { return _mm_cmpunord_pd(a, a); }
+static inline Vec either(Vec a, Vec b) { return _mm_or_pd(a, b); }
+static inline bool any(Vec mask) { return _mm_movemask_pd(mask) != 0; }
+#else
+typedef double Vec;         //no SIMD: only the scalar loops of the kernels run
+static inline Vec add(Vec a, Vec b) { return a+b; }
+static inline Vec subtract(Vec a, Vec b) { return a-b; }
+static inline Vec multiply(Vec a, Vec b) { return a*b; }
+static inline Vec divide(Vec a, Vec b) { return a/b; }
+#endif
+
+//------------------------------------------------------------------------------
+
+int array_operation(Op op, Operands kinds)
+{
+    return int(op)*4 + int(kinds);
+}
+
+//------------------------------------------------------------------------------
+// the kernels: each does one instruction for all n elements.
+// out may be a, or b, but not overlap them otherwise. For a number operand (see Operands),
+// a or b points to the number.
+
+template<class V, class S>
+static void binary_kernel(double* out, const double* a, const double* b, int n, Operands kinds, V vec_op, S op)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    switch (kinds) {
+    case Operands::arrays:
+        for ( ; i+lanes<=n; i += lanes) store(out+i, vec_op(load(a+i), load(b+i)));
+        break;
+    case Operands::number_array:
+    {   Vec x = broadcast(*a);
+        for ( ; i+lanes<=n; i += lanes) store(out+i, vec_op(x, load(b+i)));
+        break;
+    }
+    case Operands::array_number:
+    {   Vec y = broadcast(*b);
+        for ( ; i+lanes<=n; i += lanes) store(out+i, vec_op(load(a+i), y));
+        break;
+    }
+    }
+#endif
+    for ( ; i<n; ++i)
+        out[i] = op(kinds == Operands::number_array ? *a : a[i], kinds == Operands::array_number ? *b : b[i]);
+}
+
+static void negate_kernel(double* out, const double* a, int n)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    for ( ; i+lanes<=n; i += lanes) store(out+i, flip_sign(load(a+i)));
+#endif
+    for ( ; i<n; ++i) out[i] = -a[i];
+}
+
+static void square_root_kernel(double* out, const double* a, int n)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    for ( ; i+lanes<=n; i += lanes) store(out+i, roots(load(a+i)));
+#endif
+    for ( ; i<n; ++i) out[i] = sqrt(a[i]);
+}
+
+static void power_kernel(double* out, const double* a, const double* b, int n, Operands kinds)
+{
+    for (int i = 0; i<n; ++i)       //no SIMD pow gives the same results as pow()
+        out[i] = pow(kinds == Operands::number_array ? *a : a[i], kinds == Operands::array_number ? *b : b[i]);
+}
+
+//------------------------------------------------------------------------------
+// the checks, done before an operation so that a failed one leaves its operands as they were.
+// They look at all the elements, without a branch per element.
+
+static bool has_zero(const double* a, int n)
+{
+    int i = 0;
+    bool found = false;
+#if defined(__SSE2__)
+    Vec zero = broadcast(0);
+    Vec mask = broadcast(0);
+    for ( ; i+lanes<=n; i += lanes) mask = either(mask, is_equal(load(a+i), zero));
+    found = any(mask);
+#endif
+    for ( ; i<n; ++i) found |= a[i] == 0;
+    return found;
+}
+
+static bool has_negative(const double* a, int n)
+{
+    int i = 0;
+    bool found = false;
+#if defined(__SSE2__)
+    Vec zero = broadcast(0);
+    Vec mask = broadcast(0);
+    for ( ; i+lanes<=n; i += lanes) mask = either(mask, is_less(load(a+i), zero));
+    found = any(mask);
+#endif
+    for ( ; i<n; ++i) found |= a[i] < 0;
+    return found;
+}
+
+//------------------------------------------------------------------------------
+// the reductions. sum and dot add in lanes, and then the lanes, so their rounding can
+// differ from adding the elements one after the other.
+
+static double sum_kernel(const double* a, int n)
+{
+    int i = 0;
+    double s = 0;
+#if defined(__SSE2__)
+    Vec v0 = broadcast(0);          //two accumulators: an add doesn't wait for the one before
+    Vec v1 = broadcast(0);
+    for ( ; i+2*lanes<=n; i += 2*lanes) {
+        v0 = add(v0, load(a+i));
+        v1 = add(v1, load(a+i+lanes));
+    }
+    double part[lanes];
+    store(part, add(v0, v1));
+    for (int k = 0; k<lanes; ++k) s += part[k];
+#endif
+    for ( ; i<n; ++i) s += a[i];
+    return s;
+}
+
+static double dot_kernel(const double* a, const double* b, int n)
+{
+    int i = 0;
+    double s = 0;
+#if defined(__SSE2__)
+    Vec v0 = broadcast(0);
+    Vec v1 = broadcast(0);
+    for ( ; i+2*lanes<=n; i += 2*lanes) {
+        v0 = add(v0, multiply(load(a+i), load(b+i)));
+        v1 = add(v1, multiply(load(a+i+lanes), load(b+i+lanes)));
+    }
+    double part[lanes];
+    store(part, add(v0, v1));
+    for (int k = 0; k<lanes; ++k) s += part[k];
+#endif
+    for ( ; i<n; ++i) s += a[i]*b[i];
+    return s;
+}
+
+//min() and max() of an array with a NaN in it are NaN, wherever it is: with a NaN, _mm_min_pd()
+//returns its second operand and std::min() its first, so which one saw it would decide
+
+const double nan_value = numeric_limits<double>::quiet_NaN();
+
+static double min_kernel(const double* a, int n)      //n > 0
+{
+    int i = 0;
+    double m = a[0];
+#if defined(__SSE2__)
+    if (n >= lanes) {
+        Vec v = load(a);
+        Vec nan = is_nan(v);
+        for (i = lanes; i+lanes<=n; i += lanes) {
+            Vec x = load(a+i);
+            v = minimum(v, x);
+            nan = either(nan, is_nan(x));
+        }
+        if (any(nan)) return nan_value;
+        double part[lanes];
+        store(part, v);
+        for (int k = 0; k<lanes; ++k) m = min(m, part[k]);
+    }
+#endif
+    for ( ; i<n; ++i) {
+        if (a[i] != a[i]) return nan_value;
+        m = min(m, a[i]);
+    }
+    return m;
+}
+
+static double max_kernel(const double* a, int n)      //n > 0
+{
+    int i = 0;
+    double m = a[0];
+#if defined(__SSE2__)
+    if (n >= lanes) {
+        Vec v = load(a);
+        Vec nan = is_nan(v);
+        for (i = lanes; i+lanes<=n; i += lanes) {
+            Vec x = load(a+i);
+            v = maximum(v, x);
+            nan = either(nan, is_nan(x));
+        }
+        if (any(nan)) return nan_value;
+        double part[lanes];
+        store(part, v);
+        for (int k = 0; k<lanes; ++k) m = max(m, part[k]);
+    }
+#endif
+    for ( ; i<n; ++i) {
+        if (a[i] != a[i]) return nan_value;
+        m = max(m, a[i]);
+    }
+    return m;
+}
+
+//------------------------------------------------------------------------------
+
+static int allocate(Array_space& space, int n)     //a temporary of n elements: its handle
+{
+    if (space.used == space.pool.size()) space.pool.emplace_back();
+    space.pool[space.used].resize(n);
+    return space.used++;
+}
+
+static const vector<double>& array_of(const Array_space& space, double handle)
+{
+    int h = int(handle);
+    return (h < 0) ? space.table.array(-h-1) : space.pool[h];
+}
+
+//------------------------------------------------------------------------------
+
+static Error_code array_op(int slot, double* stack, int& sp, Array_space& space)
+{
+    Op op = Op(slot/4);
+    if (op == Op::negate || op == Op::square_root) {
+        double& x = stack[sp-1];
+        int n = array_of(space, x).size();
+        if (op == Op::square_root && has_negative(array_of(space, x).data(), n)) return Error_code::negative_sqrt;
+        int h = (x >= 0) ? int(x) : allocate(space, n);   //a temporary is only used once: compute into it
+        const double* a = array_of(space, x).data();
+        double* out = space.pool[h].data();
+        if (op == Op::negate) negate_kernel(out, a, n);
+        else square_root_kernel(out, a, n);
+        x = h;
+        return Error_code::none;
+    }
+
+    Operands kinds = Operands(slot%4);
+    double& x = stack[sp-2];
+    double& y = stack[sp-1];
+    int n = 0;
+    int h = -1;                     //a temporary operand, which gets the result
+    switch (kinds) {
+    case Operands::arrays:
+        n = array_of(space, x).size();
+        if (array_of(space, y).size() != n) return Error_code::size_mismatch;
+        if (x >= 0) h = int(x);
+        else if (y >= 0) h = int(y);
+        break;
+    case Operands::number_array:
+        n = array_of(space, y).size();
+        if (y >= 0) h = int(y);
+        break;
+    case Operands::array_number:
+        n = array_of(space, x).size();
+        if (x >= 0) h = int(x);
+        break;
+    }
+    if (op == Op::divide) {
+        if (kinds == Operands::array_number) {
+            if (y == 0) return Error_code::divide_by_zero;
+        }
+        else if (has_zero(array_of(space, y).data(), n)) return Error_code::divide_by_zero;
+    }
+    if (h < 0) h = allocate(space, n);
+    const double* a = (kinds == Operands::number_array) ? &x : array_of(space, x).data();   //after allocate(), which can move the pool
+    const double* b = (kinds == Operands::array_number) ? &y : array_of(space, y).data();
+    double* out = space.pool[h].data();
+    switch (op) {
+    case Op::add:
+        binary_kernel(out, a, b, n, kinds, [](Vec u, Vec v) { return add(u, v); }, [](double u, double v) { return u+v; });
+        break;
+    case Op::subtract:
+        binary_kernel(out, a, b, n, kinds, [](Vec u, Vec v) { return subtract(u, v); }, [](double u, double v) { return u-v; });
+        break;
+    case Op::multiply:
+        binary_kernel(out, a, b, n, kinds, [](Vec u, Vec v) { return multiply(u, v); }, [](double u, double v) { return u*v; });
+        break;
+    case Op::divide:
+        binary_kernel(out, a, b, n, kinds, [](Vec u, Vec v) { return divide(u, v); }, [](double u, double v) { return u/v; });
+        break;
+    default:                        //power
+        power_kernel(out, a, b, n, kinds);
+        break;
+    }
+    x = h;
+    --sp;
+    return Error_code::none;
+}
+
+//------------------------------------------------------------------------------
+
+static Error_code reduce(Reduction r, double* stack, int& sp, const Array_space& space)
+{
+    if (r == Reduction::dot) {
+        const vector<double>& a = array_of(space, stack[sp-2]);
+        const vector<double>& b = array_of(space, stack[sp-1]);
+        if (a.size() != b.size()) return Error_code::size_mismatch;
+        stack[sp-2] = dot_kernel(a.data(), b.data(), a.size());
+        --sp;
+        return Error_code::none;
+    }
+    const vector<double>& a = array_of(space, stack[sp-1]);
+    switch (r) {
+    case Reduction::sum:  stack[sp-1] = sum_kernel(a.data(), a.size()); break;
+    case Reduction::min:  stack[sp-1] = min_kernel(a.data(), a.size()); break;
+    case Reduction::max:  stack[sp-1] = max_kernel(a.data(), a.size()); break;
+    case Reduction::mean: stack[sp-1] = sum_kernel(a.data(), a.size())/a.size(); break;
+    default: break;
+    }
+    return Error_code::none;
+}
+
+//------------------------------------------------------------------------------
+
+Error_code execute_array(const Instruction& in, double* stack, int& sp, Array_space& space)
+{
+    switch (in.op) {
+    case Op::array_load:
+        stack[sp++] = -in.slot-1;
+        return Error_code::none;
+    case Op::make_array:
+    {   int h = allocate(space, in.slot);
+        sp -= in.slot;
+        copy(stack+sp, stack+sp+in.slot, space.pool[h].begin());
+        stack[sp++] = h;
+        return Error_code::none;
+    }
+    case Op::array_op:
+        return array_op(in.slot, stack, sp, space);
+    case Op::reduce:
+        return reduce(Reduction(in.slot), stack, sp, space);
+    default:
+        return Error_code::none;
+    }
+}
@@ -0,0 +1,235 @@
+//
+// Batch evaluation for the simple calculator: one compiled expression over columns of values.
+// See the Batch class in calculator.h.
+//
+// The interpreter loop of Program::run() does one row per pass over the instructions.
+// Here each pass does a block of rows: every instruction becomes a loop over the block,
+// with a fixed trip count, so the compiler turns +,-,*,/ into SIMD instructions.
+// sqrt uses SIMD intrinsics, since std::sqrt sets errno and the compiler won't vectorize it.
+// Build with -O2 or -O3; with -mavx2 (or -march=native) the loops use 256 bit registers.
+//
+
+#include "calculator.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+//------------------------------------------------------------------------------
+
+const int block = 256;      //rows per block: the stack of a block stays in the L1 cache
+
+//------------------------------------------------------------------------------
+
+Batch::Batch(const Program& p)
+    :table(&p.symbol_table()), code(p.instructions()), depth(p.stack_size()), temps(p.temp_count())
+{
+    if (p.is_declaration()) error("batch: a declaration can't be run over rows");
+    if (p.has_arrays()) error("batch: arrays can't be run over rows");
+    for (const Instruction& in : code)
+        if (in.op == Op::assign) error("batch: an assignment can't be run over rows");
+}
+
+//------------------------------------------------------------------------------
+
+void Batch::bind(int slot, const double* column)
+{
+    if (slot < 0) error("batch: bad slot");
+    if (columns.size() <= slot) columns.resize(slot+1, nullptr);
+    columns[slot] = column;
+}
+
+//------------------------------------------------------------------------------
+// the kernels: each does one instruction for a block of rows.
+// a is the left operand and gets the result, b the right operand.
+// An error is only recorded for a row that has none yet, so a row reports the same
+// (first) error as Program::run() would.
+
+static void fill_block(double* a, double d)
+{
+    for (int i = 0; i<block; ++i) a[i] = d;
+}
+
+static void negate_block(double* __restrict a)
+{
+    for (int i = 0; i<block; ++i) a[i] = -a[i];
+}
+
+static void add_block(double* __restrict a, const double* __restrict b)
+{
+    for (int i = 0; i<block; ++i) a[i] += b[i];
+}
+
+static void subtract_block(double* __restrict a, const double* __restrict b)
+{
+    for (int i = 0; i<block; ++i) a[i] -= b[i];
+}
+
+static void multiply_block(double* __restrict a, const double* __restrict b)
+{
+    for (int i = 0; i<block; ++i) a[i] *= b[i];
+}
+
+static void divide_block(double* __restrict a, const double* __restrict b, Error_code* __restrict err)
+{
+    for (int i = 0; i<block; ++i)
+        if (err[i] == Error_code::none && b[i] == 0) err[i] = Error_code::divide_by_zero;
+    for (int i = 0; i<block; ++i) a[i] /= b[i];
+}
+
+static bool is_int(double d)           //what narrow_cast<int>(d) accepts
+{
+    return -2147483648.0 <= d && d <= 2147483647.0 && double(int(d)) == d;
+}
+
+static void check_int_block(const double* __restrict a, Error_code* __restrict err)
+{
+    for (int i = 0; i<block; ++i)
+        if (err[i] == Error_code::none && !is_int(a[i])) err[i] = Error_code::not_int;
+}
+
+static void modulo_block(double* __restrict a, const double* __restrict b, Error_code* __restrict err)
+{
+    for (int i = 0; i<block; ++i) {
+        if (err[i] == Error_code::none) {
+            if (!is_int(a[i]) || !is_int(b[i])) err[i] = Error_code::not_int;
+            else if (int(b[i]) == 0) err[i] = Error_code::modulo_by_zero;
+            else {
+                a[i] = (int(b[i]) == -1) ? 0 : int(a[i]) % int(b[i]);
+                continue;
+            }
+        }
+        a[i] = 0;           //the row failed: keep int() away from what's left
+    }
+}
+
+static void int_modulo_block(double* __restrict a, const double* __restrict b, Error_code* __restrict err)
+{
+    for (int i = 0; i<block; ++i) {
+        if (err[i] == Error_code::none) {
+            if (int(b[i]) == 0) err[i] = Error_code::modulo_by_zero;
+            else {
+                a[i] = (int(b[i]) == -1) ? 0 : int(a[i]) % int(b[i]);
+                continue;
+            }
+        }
+        a[i] = 0;
+    }
+}
+
+static void square_root_block(double* __restrict a, Error_code* __restrict err)
+{
+    for (int i = 0; i<block; ++i)
+        if (err[i] == Error_code::none && a[i] < 0) err[i] = Error_code::negative_sqrt;
+    int i = 0;
+#if defined(__AVX__)
+    for ( ; i<block; i += 4) _mm256_storeu_pd(a+i, _mm256_sqrt_pd(_mm256_loadu_pd(a+i)));
+#elif defined(__SSE2__)
+    for ( ; i<block; i += 2) _mm_storeu_pd(a+i, _mm_sqrt_pd(_mm_loadu_pd(a+i)));
+#endif
+    for ( ; i<block; ++i) a[i] = sqrt(a[i]);     //sqrtpd rounds like sqrt(), negative gives NaN
+}
+
+static void power_block(double* __restrict a, const double* __restrict b)
+{
+    for (int i = 0; i<block; ++i) a[i] = pow(a[i], b[i]);   //no SIMD pow gives the same results as pow()
+}
+
+//------------------------------------------------------------------------------
+
+static bool binary(Op op)      //takes two operands off the stack, leaves one
+{
+    return op==Op::add || op==Op::subtract || op==Op::multiply
+        || op==Op::divide || op==Op::modulo || op==Op::int_modulo || op==Op::power;
+}
+
+//------------------------------------------------------------------------------
+
+int Batch::run(int rows, double* results, Error_code* errors) const
+{
+    vector<double> stack((max(depth,1)+temps)*block);
+    double* temp = &stack[0] + max(depth,1)*block;     //the temporaries follow the stack
+    Error_code err[block];
+    const double* vars = table->values();
+    int failed = 0;
+    for (int first = 0; first < rows; first += block) {
+        int n = min(block, rows-first);       //the last block can be short: the other rows are padding
+        for (int i = 0; i<block; ++i) err[i] = Error_code::none;
+        int sp = 0;                           //number of blocks on the stack
+        for (const Instruction& in : code) {
+            double* next = &stack[0] + sp*block;  //where a push goes
+            double* a = next-block;               //top of the stack
+            double* b = next-block;               //for a binary operation: the right operand...
+            if (binary(in.op)) {
+                a -= block;                       //...and a the left one, which gets the result
+                --sp;
+            }
+            switch (in.op) {
+            case Op::number:
+                fill_block(next, in.value);
+                ++sp;
+                break;
+            case Op::load:
+            {   const double* col = (in.slot < columns.size()) ? columns[in.slot] : nullptr;
+                if (col) {
+                    copy(col+first, col+first+n, next);
+                    fill_n(next+n, block-n, 1.0);         //padding: 1 fails no check
+                }
+                else fill_block(next, vars[in.slot]);
+                ++sp;
+                break;
+            }
+            case Op::assign:
+                break;                            //Batch() doesn't take programs with assignments
+            case Op::negate:
+                negate_block(a);
+                break;
+            case Op::add:
+                add_block(a, b);
+                break;
+            case Op::subtract:
+                subtract_block(a, b);
+                break;
+            case Op::multiply:
+                multiply_block(a, b);
+                break;
+            case Op::divide:
+                divide_block(a, b, err);
+                break;
+            case Op::to_int:
+                check_int_block(a, err);
+                break;
+            case Op::modulo:
+                modulo_block(a, b, err);
+                break;
+            case Op::int_modulo:
+                int_modulo_block(a, b, err);
+                break;
+            case Op::square_root:
+                square_root_block(a, err);
+                break;
+            case Op::power:
+                power_block(a, b);
+                break;
+            case Op::save:
+                copy(a, a+block, temp+in.slot*block);
+                break;
+            case Op::restore:
+                copy(temp+in.slot*block, temp+(in.slot+1)*block, next);
+                ++sp;
+                break;
+            default:                      //the array instructions: the constructor rejected them
+                break;
+            }
+        }
+        for (int i = 0; i<n; ++i) {
+            errors[first+i] = err[i];
+            if (err[i] == Error_code::none) results[first+i] = stack[i];
+            else {
+                results[first+i] = numeric_limits<double>::quiet_NaN();
+                ++failed;
+            }
+        }
+    }
+    return failed;
+}
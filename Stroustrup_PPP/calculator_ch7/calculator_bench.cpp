@@ -0,0 +1,973 @@
+// Benchmarks for the simple calculator. See calculator.cpp.
+//
+// Build: g++ -std=c++17 -O2 calculator.cpp calculator_optimize.cpp calculator_cache.cpp calculator_parallel.cpp calculator_stats.cpp calculator_server.cpp calculator_array.cpp calculator_batch.cpp calculator_jit.cpp calculator_bench.cpp -o calculator_bench -pthread
+//
+// Literals: reading number literals with read_number() (what Token_stream::get() uses)
+// against reading the same literals with >> from a stream (what the calculator used to do).
+// Batch: one formula over columns with Batch::run() against a Program::run() per row.
+// JIT: one formula evaluated many times with Jit_program::run() against Program::run().
+// Optimizer: a formula with repeated subexpressions and constants, and one with % of integer
+// subexpressions (int_modulo), run before and after optimize().
+// Arrays: an element-wise formula and dot() over arrays of a few sizes, with the array instructions
+// against a Program::run() per element of the same formula on numbers; and a check of min() and max()
+// of arrays with a NaN.
+// Sessions: independent Calculators running scripts, on 1, 2, 4, ... threads; each thread does the same work.
+// Script: one script of mostly independent statements, with Calculator::run_script() against calculate().
+// Reactive: set_value() in a reactive Symbol_table, for small and large scripts with the same affected part.
+// Allocations: calls of operator new per statement, for declarations with long names, expressions and optimize().
+// Cache: Calculator::evaluate() of a few thousand repeated formulas, with and without the Program_cache.
+// Nesting: statements nested 10 to 10^6 deep, read by the grammar functions (which keep their own stack)
+// and evaluated, in ns per level.
+// Server: a load generator for the Server: clients on their own connections, each sending batches of
+// statements in one write and waiting for all the results; throughput, and the latency of a batch.
+// Errors: input where half the statements are bad, through calculate(), and through Calculator::evaluate()
+// (which throws) against Calculator::try_evaluate() (which doesn't).
+// Output: results written as calculate() used to (cout << result << value << endl, a flush per line)
+// against a Result_writer in each Output_format, to a file and to a string.
+//
+// Suite: Token_stream::get(), expression() and Symbol_table lookups measured separately, over
+// synthetic workloads (deep nesting, long sums, many variables, pow and sqrt, literals), with
+// ns/op, allocations/op and throughput. "calculator_bench --json" runs only the suite and writes
+// the results as JSON, to compare versions.
+
+#include "calculator.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <new>
+#include <numeric>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+//------------------------------------------------------------------------------
+//count the allocations of the whole program: also those of the threads of the sessions,
+//script and server benchmarks, so the count is atomic (relaxed: only the total matters)
+
+atomic<long> allocations {0};
+
+void* operator new(size_t n)
+{
+    allocations.fetch_add(1, memory_order_relaxed);
+    if (void* p = malloc(n ? n : 1)) return p;
+    throw bad_alloc();
+}
+
+void* operator new[](size_t n) { return operator new(n); }
+
+//every delete goes through this one; not inlined, so that GCC doesn't see a free() of what
+//operator new returned (-Wmismatched-new-delete)
+[[gnu::noinline]] void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+//------------------------------------------------------------------------------
+
+double seconds_since(chrono::steady_clock::time_point t0)
+{
+    return chrono::duration<double>(chrono::steady_clock::now()-t0).count();
+}
+
+//------------------------------------------------------------------------------
+//literal-dense input: integers, decimals and e notation, separated by spaces
+
+string make_literals(int n)
+{
+    mt19937 gen(2018);
+    uniform_int_distribution<int> kind(0,3);
+    uniform_int_distribution<int> small(0,1000000);
+    uniform_int_distribution<int> exponent(-30,30);
+    ostringstream os;
+    os << setprecision(17);
+    for (int i = 0; i<n; ++i) {
+        switch (kind(gen)) {
+        case 0: os << small(gen); break;                                    //i.e. 4711
+        case 1: os << small(gen) << '.' << small(gen)%1000; break;          //i.e. 12.5
+        case 2: os << small(gen)/1000.0 << 'e' << exponent(gen); break;     //i.e. 1.25e-7
+        case 3: os << small(gen)*1e-6*small(gen); break;                    //up to 17 digits
+        }
+        os << ' ';
+    }
+    return os.str();
+}
+
+//------------------------------------------------------------------------------
+
+void bench_literals(int n)
+{
+    string text = make_literals(n);
+    vector<double> fast(n), slow(n);
+
+    auto t0 = chrono::steady_clock::now();
+    const char* p = text.data();
+    const char* last = p+text.size();
+    for (int i = 0; i<n; ++i) {
+        p = read_number(p, last, fast[i]);
+        ++p;                                  //the space
+    }
+    double t_fast = seconds_since(t0);
+
+    t0 = chrono::steady_clock::now();
+    istringstream is(text);
+    for (int i = 0; i<n; ++i) is >> slow[i];
+    double t_slow = seconds_since(t0);
+
+    int different = 0;
+    for (int i = 0; i<n; ++i)
+        if (memcmp(&fast[i], &slow[i], sizeof(double)) != 0) ++different;
+
+    cout << "literals: " << n << " (" << text.size() << " bytes)\n"
+         << "  read_number: " << t_fast*1e9/n << " ns/literal\n"
+         << "  istream >> : " << t_slow*1e9/n << " ns/literal\n"
+         << "  speedup    : " << t_slow/t_fast << "\n"
+         << "  results that are not bit-identical: " << different << "\n";
+}
+
+//------------------------------------------------------------------------------
+
+Program compile(const string& formula)
+{
+    Token_stream ts(formula);
+    Program prog;
+    statement(ts, prog);
+    return prog;
+}
+
+//------------------------------------------------------------------------------
+
+void bench_batch(const string& formula, int rows)
+{
+    int x = symbols.intern("x");
+    int y = symbols.intern("y");
+    symbols.declare(x, 0);
+    symbols.declare(y, 0);
+    Program prog = compile(formula);
+
+    mt19937 gen(2018);
+    uniform_real_distribution<double> values(-10,100);
+    vector<double> xs(rows), ys(rows);
+    for (int i = 0; i<rows; ++i) {
+        xs[i] = values(gen);
+        ys[i] = (i%1000 == 0) ? 0 : values(gen);       //some rows fail
+    }
+
+    vector<double> batch_results(rows);
+    vector<Error_code> errors(rows);
+    Batch batch(prog);
+    batch.bind(x, &xs[0]);
+    batch.bind(y, &ys[0]);
+    auto t0 = chrono::steady_clock::now();
+    int failed = batch.run(rows, &batch_results[0], &errors[0]);
+    double t_batch = seconds_since(t0);
+
+    vector<double> row_results(rows);
+    int row_failed = 0;
+    int different = 0;
+    t0 = chrono::steady_clock::now();
+    for (int i = 0; i<rows; ++i) {
+        symbols.set(x, xs[i]);
+        symbols.set(y, ys[i]);
+        try {
+            row_results[i] = prog.run();
+        }
+        catch (runtime_error& e) {
+            ++row_failed;
+            if (e.what() != Error{errors[i], string_view()}.message()) ++different;
+            continue;
+        }
+        if (errors[i] != Error_code::none || memcmp(&row_results[i], &batch_results[i], sizeof(double)) != 0) ++different;
+    }
+    double t_rows = seconds_since(t0);
+
+    cout << "batch: " << formula << " over " << rows << " rows\n"
+         << "  Batch::run   : " << t_batch*1e9/rows << " ns/row\n"
+         << "  Program::run : " << t_rows*1e9/rows << " ns/row\n"
+         << "  speedup      : " << t_rows/t_batch << "\n"
+         << "  rows with errors: " << failed << " (per row: " << row_failed << ")"
+         << ", rows that differ: " << different << "\n";
+}
+
+//------------------------------------------------------------------------------
+
+void bench_jit(const string& formula, int n)
+{
+    int x = symbols.intern("x");
+    int y = symbols.intern("y");
+    symbols.declare(x, 0);
+    symbols.declare(y, 1);
+    Program prog = compile(formula);
+    Jit_program jit(prog);
+
+    double sum_interpreted = 0;
+    auto t0 = chrono::steady_clock::now();
+    for (int i = 0; i<n; ++i) {
+        symbols.set(x, i);
+        sum_interpreted += prog.run();
+    }
+    double t_interpreted = seconds_since(t0);
+
+    double sum_jit = 0;
+    t0 = chrono::steady_clock::now();
+    for (int i = 0; i<n; ++i) {
+        symbols.set(x, i);
+        sum_jit += jit.run();
+    }
+    double t_jit = seconds_since(t0);
+
+    cout << "jit: " << formula << ", " << n << " evaluations" << (jit.native() ? "" : " (no native code)") << "\n"
+         << "  Program::run     : " << t_interpreted*1e9/n << " ns\n"
+         << "  Jit_program::run : " << t_jit*1e9/n << " ns\n"
+         << "  speedup          : " << t_interpreted/t_jit << "\n"
+         << "  same results     : " << (memcmp(&sum_interpreted, &sum_jit, sizeof(double)) == 0 ? "yes" : "no") << "\n";
+}
+
+//------------------------------------------------------------------------------
+//groups of declarations that don't use each other, each followed by a statement that uses the group
+
+string make_independent_script(int statements)
+{
+    ostringstream os;
+    for (int i = 0; i<statements; ++i) {
+        if (i%8 == 7) os << "w" << i/8 << " + w" << i-1 << " * 2;\n";
+        else os << "let w" << i << " = sqrt(" << i << ") * pow(" << i%10 << ",3) + " << i << "%7;\n";
+    }
+    return os.str();
+}
+
+//------------------------------------------------------------------------------
+
+void bench_script(int statements, int threads)
+{
+    string script = make_independent_script(statements);
+
+    ostringstream sequential;
+    auto t0 = chrono::steady_clock::now();
+    {
+        Calculator calc;
+        Token_stream ts(script);
+        calc.calculate(ts, sequential, sequential);
+    }
+    double t_sequential = seconds_since(t0);
+
+    ostringstream parallel;
+    t0 = chrono::steady_clock::now();
+    {
+        Calculator calc;
+        calc.run_script(script, parallel, parallel, threads);
+    }
+    double t_parallel = seconds_since(t0);
+
+    cout << "script: " << statements << " statements, " << threads << " threads\n"
+         << "  calculate()  : " << t_sequential*1e3 << " ms\n"
+         << "  run_script() : " << t_parallel*1e3 << " ms\n"
+         << "  speedup      : " << t_sequential/t_parallel << "\n"
+         << "  same output  : " << (sequential.str() == parallel.str() ? "yes" : "no") << "\n";
+}
+
+//------------------------------------------------------------------------------
+
+void bench_nesting()
+{
+    Symbol_table st;
+    st.declare("x", 2);
+    cout << "nesting: ns per level, to read / to read, optimize and run\n";
+    for (int depth = 10; depth <= 1000000; depth *= 10) {
+        const pair<string,string> shapes[] = {
+            {"((x+1)+1)...", string(depth, '(') + [&] { string s = "x"; for (int i = 0; i<depth; ++i) s += "+1)"; return s; }()},
+            {"1+(1+(...))", [&] { string s; for (int i = 0; i<depth; ++i) s += "1+("; return s + "x" + string(depth, ')'); }()},
+            {"- - ... -x", string(depth, '-') + "x"},
+        };
+        cout << "  depth " << setw(7) << depth << ":";
+        for (const auto& shape : shapes) {
+            int reps = max(1, 2000000/depth);
+            Program prog(st);
+            auto t0 = chrono::steady_clock::now();
+            for (int r = 0; r<reps; ++r) {
+                Token_stream ts(shape.second);
+                prog.clear();
+                if (!expression(ts, prog)) error(prog.last_error().message());
+            }
+            double t_read = seconds_since(t0);
+            t0 = chrono::steady_clock::now();
+            for (int r = 0; r<reps; ++r) {
+                Token_stream ts(shape.second);
+                prog.clear();
+                evaluate(ts, prog);
+            }
+            double t_evaluate = seconds_since(t0);
+            cout << "  " << shape.first << " " << t_read*1e9/reps/depth << " / " << t_evaluate*1e9/reps/depth;
+        }
+        cout << "\n";
+    }
+}
+
+//------------------------------------------------------------------------------
+
+#if defined(__unix__) || defined(__APPLE__)
+
+void bench_server(int clients, int batch, int batches)
+{
+    const string path = "/tmp/calculator_bench." + to_string(getpid()) + ".sock";
+    Server server(path);
+    thread serving([&] { server.run(); });
+
+    vector<vector<double>> latencies(clients);      //seconds per batch, by client
+    vector<long> wrong(clients, 0);                 //batches with a result that isn't right
+    auto client = [&](int id) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr {};
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size()+1);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) error("bench: can't connect to ", path);
+        string expected;
+        string text = "let x = " + to_string(id) + ";";       //each session has its own x
+        expected = "= " + to_string(id) + "\n";
+        for (int i = 1; i<batch; ++i) {
+            text += "x*2+" + to_string(i) + ";";
+            expected += "= " + to_string(2*id+i) + "\n";
+        }
+        string after = text.substr(text.find(';')+1) + "x*2+0;";    //batches after the first don't declare x
+        string after_expected = expected.substr(expected.find('\n')+1) + "= " + to_string(2*id) + "\n";
+        string received;
+        char buf[1<<16];
+        for (int b = 0; b<batches; ++b) {
+            const string& out = b ? after : text;
+            const string& want = b ? after_expected : expected;
+            auto t0 = chrono::steady_clock::now();
+            for (size_t sent = 0; sent < out.size(); ) {
+                ssize_t n = send(fd, out.data()+sent, out.size()-sent, 0);
+                if (n <= 0) error("bench: send failed");
+                sent += n;
+            }
+            received.clear();
+            while (received.size() < want.size()) {
+                ssize_t n = recv(fd, buf, sizeof(buf), 0);
+                if (n <= 0) error("bench: the server closed the connection");
+                received.append(buf, n);
+            }
+            latencies[id].push_back(seconds_since(t0));
+            if (received != want) ++wrong[id];
+        }
+        close(fd);
+    };
+    auto t0 = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (int i = 0; i<clients; ++i) threads.push_back(thread(client, i));
+    for (thread& t : threads) t.join();
+    double t = seconds_since(t0);
+    server.stop();
+    serving.join();
+
+    vector<double> all;
+    for (const auto& v : latencies) all.insert(all.end(), v.begin(), v.end());
+    sort(all.begin(), all.end());
+    auto at = [&](double p) { return all[min(all.size()-1, size_t(p*all.size()))]*1e6; };
+    long statements = long(clients)*batch*batches;
+    cout << "server: " << clients << " clients, batches of " << batch << " statements\n"
+         << "  throughput    : " << statements/t/1e6 << " M statements/s\n"
+         << "  batch latency : p50 " << at(0.5) << " us, p99 " << at(0.99) << " us, p99.9 " << at(0.999)
+         << " us, max " << all.back()*1e6 << " us\n"
+         << "  wrong results : " << accumulate(wrong.begin(), wrong.end(), 0L) << "\n";
+}
+
+#endif
+
+//------------------------------------------------------------------------------
+
+void bench_output(int values)
+{
+    mt19937 gen(7);
+    uniform_real_distribution<double> dist(-1e6, 1e6);
+    vector<double> results(values);
+    for (double& d : results) d = dist(gen);
+    const char* file = "calculator_bench_output.tmp";
+
+    auto by_line = [&](ostream& os) {
+        for (double d : results) os << result << d << endl;
+    };
+    auto by_writer = [&](ostream& os, Output_format f) {
+        Result_writer w(os, f);
+        for (double d : results) w.add(d);
+    };
+    auto to_file = [&](auto write) {
+        ofstream os(file, ios_base::binary);
+        auto t0 = chrono::steady_clock::now();
+        write(os);
+        os.close();
+        return seconds_since(t0);
+    };
+    auto to_string = [&](auto write) {
+        ostringstream os;
+        auto t0 = chrono::steady_clock::now();
+        write(os);
+        return seconds_since(t0);
+    };
+
+    cout << "output: " << values << " results, ns/result to a file (to a string)\n";
+    cout << "  << and endl      : " << to_file(by_line)*1e9/values << " (" << to_string(by_line)*1e9/values << ")\n";
+    const char* names[] = {"text", "shortest", "csv", "binary"};
+    for (Output_format f : {Output_format::text, Output_format::shortest, Output_format::csv, Output_format::binary}) {
+        auto write = [&](ostream& os) { by_writer(os, f); };
+        cout << "  " << setw(17) << left << names[int(f)] << right << ": " << to_file(write)*1e9/values
+             << " (" << to_string(write)*1e9/values << ")\n";
+    }
+    remove(file);
+}
+
+//------------------------------------------------------------------------------
+
+void bench_errors(int statements)
+{
+    const char* bad[] = {"1/0", "sqrt(-2)", "2.5%2", "(1+2", "y+1", "$", "1e", "pow(2 3)", "let = 2"};
+    vector<string> texts;
+    string script;
+    for (int i = 0; i<statements; ++i) {
+        texts.push_back(i%2 ? string(bad[(i/2)%9]) : to_string(i) + "*2+1");
+        script += texts.back() + ";\n";
+    }
+
+    ostringstream out;
+    auto t0 = chrono::steady_clock::now();
+    {
+        Calculator calc;
+        Token_stream ts(script);
+        calc.calculate(ts, out, out);
+    }
+    double t_calculate = seconds_since(t0);
+
+    Calculator calc;
+    long failed_throwing = 0;
+    t0 = chrono::steady_clock::now();
+    for (const string& s : texts) {
+        try {
+            calc.evaluate(s);
+        }
+        catch (runtime_error&) {
+            ++failed_throwing;
+        }
+    }
+    double t_throwing = seconds_since(t0);
+
+    long failed = 0;
+    t0 = chrono::steady_clock::now();
+    for (const string& s : texts)
+        if (!calc.try_evaluate(s)) ++failed;
+    double t_result = seconds_since(t0);
+
+    cout << "errors: " << statements << " statements, half of them bad\n"
+         << "  calculate()      : " << t_calculate*1e9/statements << " ns/statement\n"
+         << "  evaluate()       : " << t_throwing*1e9/statements << " ns/statement (throws)\n"
+         << "  try_evaluate()   : " << t_result*1e9/statements << " ns/statement\n"
+         << "  speedup          : " << t_throwing/t_result << "\n"
+         << "  same errors      : " << (failed == failed_throwing ? "yes" : "no") << "\n";
+}
+
+//------------------------------------------------------------------------------
+//groups of 10 variables, each computed from the one before: an update of the first
+//variable of a group recomputes 9 others, however many groups there are
+
+void bench_reactive(int groups, int updates)
+{
+    Calculator calc;
+    Symbol_table& vars = calc.variables();
+    vars.set_reactive(true);
+    ostringstream script;
+    for (int g = 0; g<groups; ++g) {
+        script << "let g" << g << "_0 = " << g << ";";
+        for (int i = 1; i<10; ++i) script << "let g" << g << "_" << i << " = g" << g << "_" << i-1 << "*1.5 + sqrt(g" << g << "_" << i-1 << ");";
+    }
+    string text = script.str();
+    Token_stream ts(text);
+    ostringstream output;
+    auto t0 = chrono::steady_clock::now();
+    calc.calculate(ts, output, output);
+    double t_script = seconds_since(t0);
+
+    vector<string> roots;
+    for (int g = 0; g<groups; ++g) roots.push_back("g" + to_string(g) + "_0");
+    t0 = chrono::steady_clock::now();
+    for (int i = 0; i<updates; ++i) vars.set_value(roots[i%groups], i);
+    double t_update = seconds_since(t0);
+
+    cout << "reactive: " << groups*10 << " variables, 10 affected by each update\n"
+         << "  running the script : " << t_script*1e3 << " ms\n"
+         << "  set_value()        : " << t_update*1e9/updates << " ns/update\n";
+}
+
+//------------------------------------------------------------------------------
+
+void bench_allocations(int statements)
+{
+    Calculator calc;
+    ostringstream output;
+    output << string(statements*64, ' ');     //so the output buffer doesn't grow while counting
+    cout << "allocations: per statement, " << statements << " statements\n";
+
+    string declarations;
+    for (int i = 0; i<statements; ++i)
+        declarations += "let a_rather_long_variable_name_" + to_string(i) + " = " + to_string(i) + ";\n";
+    Token_stream ts(declarations);
+    output.str("");
+    long n0 = allocations;
+    calc.calculate(ts, output, output);
+    cout << "  let with long names : " << double(allocations-n0)/statements << "\n";
+
+    string expressions;
+    for (int i = 0; i<statements; ++i)
+        expressions += "(a_rather_long_variable_name_" + to_string(i) + " + 1) * sqrt(pi) - 3 % 2;\n";
+    Token_stream ts2(expressions);
+    output.str("");
+    n0 = allocations;
+    calc.calculate(ts2, output, output);
+    cout << "  expressions         : " << double(allocations-n0)/statements << "\n";
+
+    Program prog(calc.variables());
+    long optimizing = 0;
+    for (int i = 0; i<statements; ++i) {
+        string formula = "(a_rather_long_variable_name_" + to_string(i%100) + " * 2 + 1) * (a_rather_long_variable_name_"
+                         + to_string(i%100) + " * 2 + 1) / sqrt(pi*k)";
+        Token_stream ts3(formula);
+        prog.clear();
+        statement(ts3, prog);
+        n0 = allocations;
+        optimize(prog);
+        optimizing += allocations-n0;
+    }
+    cout << "  optimize()          : " << double(optimizing)/statements << "\n";
+}
+
+//------------------------------------------------------------------------------
+
+void bench_cache(int formulas, int n, size_t limit)
+{
+    mt19937 gen(2018);
+    uniform_int_distribution<int> digit(1,9);
+    vector<string> texts;
+    for (int i = 0; i<formulas; ++i)
+        texts.push_back("(x + " + to_string(i) + ") * (y - " + to_string(digit(gen)) + ") + sqrt(x*x + " + to_string(digit(gen)) + ") / pi");
+    vector<int> order(n);
+    exponential_distribution<double> popular(8.0/formulas);     //a few formulas come much more often
+    for (int& i : order) i = min(int(popular(gen)), formulas-1);
+
+    double times[2];
+    double sums[2];
+    Cache_stats stats;
+    for (int cached = 0; cached<2; ++cached) {
+        Calculator calc;
+        calc.programs().set_limit(cached ? limit : 0);
+        calc.evaluate("let x = 1");
+        calc.evaluate("let y = 2");
+        sums[cached] = 0;
+        auto t0 = chrono::steady_clock::now();
+        for (int i = 0; i<n; ++i) {
+            calc.variables().set_value("x", i%100);
+            sums[cached] += calc.evaluate(texts[order[i]]);
+        }
+        times[cached] = seconds_since(t0);
+        stats = calc.programs().stats();
+    }
+
+    cout << "cache: " << formulas << " formulas, " << n << " evaluations, limit " << limit/1024 << " KB\n"
+         << "  no cache     : " << times[0]*1e9/n << " ns\n"
+         << "  cache        : " << times[1]*1e9/n << " ns\n"
+         << "  speedup      : " << times[0]/times[1] << "\n"
+         << "  hits " << stats.hits << ", misses " << stats.misses << ", evictions " << stats.evictions
+         << ", " << stats.entries << " entries in " << stats.bytes/1024 << " KB\n"
+         << "  same results : " << (memcmp(&sums[0], &sums[1], sizeof(double)) == 0 ? "yes" : "no") << "\n";
+}
+
+//------------------------------------------------------------------------------
+
+void bench_optimize(const string& formula, int n)
+{
+    int x = symbols.intern("x");
+    int y = symbols.intern("y");
+    symbols.declare(x, 0);
+    symbols.declare(y, 1);
+    symbols.declare_constant("pi", 3.1415926535);      //as in calculator_main.cpp
+    symbols.declare_constant("k", 1000);
+    Program prog = compile(formula);
+    Program optimized = prog;
+    optimize(optimized);
+
+    double sum_plain = 0;
+    auto t0 = chrono::steady_clock::now();
+    for (int i = 0; i<n; ++i) {
+        symbols.set(x, i);
+        sum_plain += prog.run();
+    }
+    double t_plain = seconds_since(t0);
+
+    double sum_optimized = 0;
+    t0 = chrono::steady_clock::now();
+    for (int i = 0; i<n; ++i) {
+        symbols.set(x, i);
+        sum_optimized += optimized.run();
+    }
+    double t_optimized = seconds_since(t0);
+
+    cout << "optimize: " << formula << ", " << n << " evaluations\n"
+         << "  instructions : " << prog.size() << " -> " << optimized.size()
+         << " (" << optimized.temp_count() << " temporaries)\n"
+         << "  Program::run : " << t_plain*1e9/n << " ns -> " << t_optimized*1e9/n << " ns\n"
+         << "  speedup      : " << t_plain/t_optimized << "\n"
+         << "  same results : " << (memcmp(&sum_plain, &sum_optimized, sizeof(double)) == 0 ? "yes" : "no") << "\n";
+}
+
+//------------------------------------------------------------------------------
+
+void bench_arrays(int elements, int n)
+{
+    int x = symbols.intern("x");
+    int y = symbols.intern("y");
+    symbols.declare(x, 0);
+    symbols.declare(y, 0);
+    mt19937 gen(2018);
+    uniform_real_distribution<double> values(-10,100);
+    vector<double> xs(elements), ys(elements);
+    for (int i = 0; i<elements; ++i) {
+        xs[i] = values(gen);
+        ys[i] = values(gen);
+    }
+    string a_name = "a" + to_string(elements);     //a new pair of arrays for each size: they can't be assigned
+    string b_name = "b" + to_string(elements);
+    symbols.declare_array(symbols.intern(a_name), xs);
+    symbols.declare_array(symbols.intern(b_name), ys);
+    Program scalar = compile("x*y + x/2 - sqrt(y*y)");
+    Program array = compile(a_name + "*" + b_name + " + " + a_name + "/2 - sqrt(" + b_name + "*" + b_name + ")");
+    Program scalar_dot = compile("x*y");
+    Program array_dot = compile("dot(" + a_name + ", " + b_name + ")");
+
+    vector<double> results(elements);
+    auto t0 = chrono::steady_clock::now();
+    for (int k = 0; k<n; ++k)
+        for (int i = 0; i<elements; ++i) {
+            symbols.set(x, xs[i]);
+            symbols.set(y, ys[i]);
+            results[i] = scalar.run();
+        }
+    double t_scalar = seconds_since(t0);
+
+    const vector<double>* array_results = nullptr;
+    t0 = chrono::steady_clock::now();
+    for (int k = 0; k<n; ++k) array_results = array.try_run().array;
+    double t_array = seconds_since(t0);
+
+    double sum_scalar = 0;
+    t0 = chrono::steady_clock::now();
+    for (int k = 0; k<n; ++k) {
+        sum_scalar = 0;
+        for (int i = 0; i<elements; ++i) {
+            symbols.set(x, xs[i]);
+            symbols.set(y, ys[i]);
+            sum_scalar += scalar_dot.run();
+        }
+    }
+    double t_scalar_dot = seconds_since(t0);
+
+    double sum_array = 0;
+    t0 = chrono::steady_clock::now();
+    for (int k = 0; k<n; ++k) sum_array = array_dot.run();
+    double t_array_dot = seconds_since(t0);
+
+    double total = double(elements)*n;
+    bool same = array_results && memcmp(&(*array_results)[0], &results[0], elements*sizeof(double)) == 0;
+    cout << "arrays: " << elements << " elements, " << n << " times\n"
+         << "  x*y + x/2 - sqrt(y*y) : " << t_scalar*1e9/total << " ns/element -> " << t_array*1e9/total << " ns/element"
+         << " (speedup " << t_scalar/t_array << ", same results: " << (same ? "yes" : "no") << ")\n"
+         << "  dot                   : " << t_scalar_dot*1e9/total << " ns/element -> " << t_array_dot*1e9/total << " ns/element"
+         << " (speedup " << t_scalar_dot/t_array_dot << ", relative difference " << abs(sum_array-sum_scalar)/abs(sum_scalar) << ")\n";
+}
+
+//------------------------------------------------------------------------------
+//min() and max() of arrays of 1 to 20 elements, with a NaN at each place and without: the SIMD
+//part of the kernels and the scalar rest must agree on NaN, wherever it is
+
+void check_min_max()
+{
+    mt19937 gen(2018);
+    uniform_real_distribution<double> values(-10,100);
+    int wrong = 0;
+    int checks = 0;
+    for (int elements = 1; elements<=20; ++elements) {
+        vector<double> xs(elements);
+        for (double& d : xs) d = values(gen);
+        for (int place = -1; place<elements; ++place) {    //-1: no NaN
+            vector<double> v = xs;
+            if (place >= 0) v[place] = numeric_limits<double>::quiet_NaN();
+            string name = "m" + to_string(elements) + "_" + to_string(place+1);
+            symbols.declare_array(symbols.intern(name), v);
+            double lo = compile("min(" + name + ")").run();
+            double hi = compile("max(" + name + ")").run();
+            if (place >= 0) wrong += !isnan(lo) + !isnan(hi);
+            else wrong += (lo != *min_element(xs.begin(), xs.end())) + (hi != *max_element(xs.begin(), xs.end()));
+            checks += 2;
+        }
+    }
+    cout << "min/max: " << checks << " arrays of 1 to 20 elements, NaN anywhere or nowhere; wrong results: " << wrong << "\n";
+}
+
+//------------------------------------------------------------------------------
+//a script of declarations and expressions, each statement using the ones before. No statement fails
+
+string make_script(int statements)
+{
+    ostringstream os;
+    os << "let v0 = 1;\n";
+    for (int i = 1; i<statements; ++i) {
+        switch (i%4) {
+        case 0: os << "let v" << i << " = v" << i-1 << "*0.5 + pi;\n"; break;
+        case 1: os << "let v" << i << " = sqrt(v" << i-1 << ") - 1/k;\n"; break;
+        case 2: os << "let v" << i << " = pow(v" << i-1 << ",2) + " << i << "%7 - e;\n"; break;
+        case 3: os << "let v" << i << " = (v" << i-1 << " + v" << i-2 << ") * (v" << i-1 << " - 3) / 16;\n"; break;
+        }
+    }
+    return os.str();
+}
+
+//------------------------------------------------------------------------------
+
+void bench_sessions(int sessions_per_thread, int statements)
+{
+    string script = make_script(statements);
+    int max_threads = max(1u, thread::hardware_concurrency());
+    cout << "sessions: " << sessions_per_thread << " sessions of " << statements << " statements per thread"
+         << ", " << max_threads << " hardware threads\n";
+    double base = 0;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        vector<thread> pool;
+        vector<size_t> output(threads);
+        auto t0 = chrono::steady_clock::now();
+        for (int t = 0; t<threads; ++t)
+            pool.push_back(thread([&,t] {
+                for (int s = 0; s<sessions_per_thread; ++s) {
+                    Calculator calc;             //a session: its own variables, nothing shared
+                    Token_stream ts(script);
+                    ostringstream os;
+                    calc.calculate(ts, os, os);
+                    output[t] += os.str().size();
+                }
+            }));
+        for (thread& th : pool) th.join();
+        double t = seconds_since(t0);
+        double rate = double(threads)*sessions_per_thread*statements/t;
+        if (threads == 1) base = rate;
+        bool same = true;
+        for (size_t n : output) if (n != output[0]) same = false;
+        cout << "  " << threads << " threads: " << rate/1e6 << " M statements/s, scaling "
+             << rate/base << " (ideal " << threads << ")" << (same ? "" : ", outputs differ") << "\n";
+        if (threads*2 > max_threads && threads != max_threads) threads = max_threads/2;   //also the last count
+    }
+}
+
+//------------------------------------------------------------------------------
+
+//------------------------------------------------------------------------------
+// the suite
+
+struct Measurement {
+    string benchmark;        //what was measured: tokenizer, expression, lookup
+    string workload;
+    long ops;                //tokens, statements or lookups
+    double seconds;
+    long allocations;
+    size_t bytes;            //of input, 0 if not meaningful
+};
+
+vector<Measurement> results;
+
+template<class F> void measure(const string& benchmark, const string& workload, size_t bytes, F f)   //f() does the work, returns the number of ops
+{
+    long n0 = allocations;
+    auto t0 = chrono::steady_clock::now();
+    long ops = f();
+    double t = seconds_since(t0);
+    results.push_back(Measurement{benchmark, workload, ops, t, allocations-n0, bytes});
+}
+
+//------------------------------------------------------------------------------
+//the workloads: each is one statement over the variables x, y and v0...v9999
+
+const int workload_variables = 10000;
+
+string deep_nesting(int depth)     //((((...(x+1)...)+1)+1)+1)
+{
+    string s = string(depth, '(') + "x";
+    for (int i = 0; i<depth; ++i) s += "+1)";
+    return s + ";";
+}
+
+string long_sum(int terms)         //x+1+x+2+...
+{
+    string s = "x";
+    for (int i = 1; i<terms; ++i) s += (i%2) ? "+" + to_string(i) : "+x";
+    return s + ";";
+}
+
+string many_variables(int terms)   //v17*v4711+v3-...
+{
+    mt19937 gen(2018);
+    uniform_int_distribution<int> var(0, workload_variables-1);
+    string s = "v" + to_string(var(gen));
+    for (int i = 1; i<terms; ++i) s += string(1, "+-*"[i%3]) + "v" + to_string(var(gen));
+    return s + ";";
+}
+
+string pow_sqrt(int terms)         //sqrt(pow(x,2)+pow(y,3))+...
+{
+    string s = "sqrt(pow(x,2)+pow(y,3))";
+    for (int i = 1; i<terms; ++i) s += "+sqrt(pow(x," + to_string(i%5) + ")*y+" + to_string(i) + ")";
+    return s + ";";
+}
+
+string dense_literals(int terms)   //12.5+1.25e-7+4711+...
+{
+    string s = make_literals(terms);
+    for (char& c : s) if (c == ' ') c = '+';
+    s.back() = ';';
+    return s;
+}
+
+//------------------------------------------------------------------------------
+
+void run_suite()
+{
+    Symbol_table st;
+    st.declare("x", 2);
+    st.declare("y", 3);
+    vector<string> names;
+    for (int i = 0; i<workload_variables; ++i) {
+        names.push_back("v" + to_string(i));
+        st.declare(names.back(), i);
+    }
+
+    const pair<string,string> workloads[] = {
+        {"deep_nesting", deep_nesting(1000)},
+        {"long_sum", long_sum(10000)},
+        {"many_variables", many_variables(10000)},
+        {"pow_sqrt", pow_sqrt(2000)},
+        {"literals", dense_literals(10000)},
+    };
+    for (const auto& w : workloads) {
+        const string& text = w.second;
+        int reps = max(1, int(2000000/text.size()));      //about 2 MB of input per measurement
+
+        measure("tokenizer", w.first, reps*text.size(), [&] {
+            long tokens = 0;
+            for (int r = 0; r<reps; ++r) {
+                Token_stream ts(text);
+                while (ts.get().kind != quit) ++tokens;
+            }
+            return tokens;
+        });
+
+        Program prog(st);
+        measure("expression", w.first, reps*text.size(), [&] {
+            for (int r = 0; r<reps; ++r) {
+                Token_stream ts(text);
+                prog.clear();
+                expression(ts, prog);
+            }
+            return long(reps);
+        });
+    }
+
+    vector<string> missing;
+    for (int i = 0; i<workload_variables; ++i) missing.push_back("w" + to_string(i));
+    const int rounds = 200;
+    measure("lookup", "declared_names", 0, [&] {
+        long found = 0;
+        for (int r = 0; r<rounds; ++r)
+            for (const string& s : names) found += st.get_slot(s) >= 0;
+        return found;
+    });
+    measure("lookup", "missing_names", 0, [&] {
+        long n = 0;
+        for (int r = 0; r<rounds; ++r)
+            for (const string& s : missing) n += st.find(s) < 0;
+        return n;
+    });
+}
+
+//------------------------------------------------------------------------------
+
+void print_results_json(ostream& os)
+{
+    os << "{\n  \"results\": [\n";
+    for (size_t i = 0; i<results.size(); ++i) {
+        const Measurement& r = results[i];
+        os << "    {\"benchmark\": \"" << r.benchmark << "\", \"workload\": \"" << r.workload << "\""
+           << ", \"ops\": " << r.ops
+           << ", \"ns_per_op\": " << r.seconds*1e9/r.ops
+           << ", \"ops_per_second\": " << r.ops/r.seconds
+           << ", \"allocations_per_op\": " << double(r.allocations)/r.ops;
+        if (r.bytes) os << ", \"mb_per_second\": " << r.bytes/r.seconds/1e6;
+        os << "}" << (i+1 < results.size() ? "," : "") << "\n";
+    }
+    os << "  ]\n}\n";
+}
+
+//------------------------------------------------------------------------------
+
+void print_results(ostream& os)
+{
+    os << "suite:\n";
+    for (const Measurement& r : results) {
+        os << "  " << setw(10) << left << r.benchmark << " " << setw(15) << r.workload << right
+           << setw(10) << r.seconds*1e9/r.ops << " ns/op " << setw(10) << double(r.allocations)/r.ops << " allocations/op";
+        if (r.bytes) os << setw(10) << r.bytes/r.seconds/1e6 << " MB/s";
+        os << "\n";
+    }
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+try {
+    if (argc == 2 && argv[1] == string("--json")) {
+        run_suite();
+        print_results_json(cout);
+        return 0;
+    }
+    bench_literals(2000000);
+    bench_batch("x*x + 2*x*y - y/3", 4000000);
+    bench_batch("sqrt(y)*x - 1/y", 4000000);
+    bench_batch("pow(x,2) + y", 4000000);
+    bench_jit("x*x + 2*x*y - y/3", 10000000);
+    bench_jit("((x+1)*(x-1) + (x+2)*(x-2)) / (y+1) - sqrt(x)", 10000000);
+    bench_sessions(200, 1000);
+    bench_script(100000, max(2u, thread::hardware_concurrency()));
+    bench_allocations(100000);
+    bench_cache(3000, 2000000, 1<<20);
+    bench_cache(3000, 2000000, 64<<10);
+    bench_errors(200000);
+    bench_output(1000000);
+    bench_nesting();
+#if defined(__unix__) || defined(__APPLE__)
+    bench_server(1, 1, 20000);
+    bench_server(1, 100, 2000);
+    bench_server(8, 100, 500);
+    bench_server(64, 10, 200);
+#endif
+    bench_reactive(100, 1000000);
+    bench_reactive(100000, 1000000);
+    bench_optimize("(x*y+1)*(x*y+1) + 2*pi*k*sqrt(x*y+1) - (x*y+1)/1 + 0*k", 10000000);
+    bench_optimize("(x % 1000) * (y % 1000) % 97 + x % 7 % 5", 10000000);
+    bench_arrays(16, 1000000);
+    bench_arrays(1000, 20000);
+    bench_arrays(100000, 200);
+    check_min_max();
+    run_suite();
+    print_results(cout);
+    return 0;
+}
+catch (exception& e) {
+    cerr << "exception: " << e.what() << endl;
+    return 1;
+}
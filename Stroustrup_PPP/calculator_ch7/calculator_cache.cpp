@@ -0,0 +1,112 @@
+//
+// The cache of compiled statements for the simple calculator: see Program_cache in calculator.h.
+//
+// The entries are kept in a list, the most recently used first, and found through a hash table
+// by their key. A hit moves its entry to the front; when the cache is over its limit, entries
+// are dropped from the back.
+//
+
+#include "calculator.h"
+
+//------------------------------------------------------------------------------
+
+static bool is_word_char(char c)    //a character of a name or a number
+{
+    return isalpha(c) || isdigit(c) || c == '_' || c == '.';
+}
+
+//------------------------------------------------------------------------------
+//whitespace only matters between two characters that would otherwise be read as one
+//name or number ("let x", "1 2"); elsewhere Token_stream::get() skips it
+
+void Program_cache::normalize(string_view text, string& key)
+{
+    key.clear();
+    size_t i = 0;
+    while (i < text.size()) {
+        if (isspace(text[i])) {
+            while (i < text.size() && isspace(text[i])) ++i;
+            if (!key.empty() && i < text.size() && is_word_char(key.back()) && is_word_char(text[i])) key += ' ';
+            continue;
+        }
+        key += text[i++];
+    }
+}
+
+//------------------------------------------------------------------------------
+
+const Program* Program_cache::find(string_view key)
+{
+    auto p = index.find(key);
+    if (p == index.end()) {
+        ++stats_.misses;
+        return nullptr;
+    }
+    if (!p->second->prog.is_current()) {    //a constant it used has been assigned
+        erase(p->second);
+        ++stats_.invalidations;
+        ++stats_.misses;
+        return nullptr;
+    }
+    entries.splice(entries.begin(), entries, p->second);   //now the most recently used
+    ++stats_.hits;
+    return &entries.front().prog;
+}
+
+//------------------------------------------------------------------------------
+
+void Program_cache::insert(string_view key, const Program& prog)
+{
+    if (limit == 0 || prog.is_declaration() || index.count(key)) return;
+    for (const Instruction& in : prog.instructions())
+        if (in.op == Op::assign) return;
+    entries.push_front(Entry{string(key), prog, 0});
+    Entry& e = entries.front();
+    e.prog.set_eager(false);
+    optimize(e.prog, true);          //the same results as without the cache
+    e.bytes = sizeof(Entry) + e.key.capacity() + e.prog.size()*sizeof(Instruction)
+            + e.prog.stack_size()*sizeof(double) + 4*sizeof(void*)     //the list and index nodes
+            + e.prog.pool_bytes();           //the arrays of a run: prog has run, and they keep their sizes
+    index[e.key] = entries.begin();
+    stats_.bytes += e.bytes;
+    ++stats_.entries;
+    shrink();
+}
+
+//------------------------------------------------------------------------------
+
+void Program_cache::erase(list<Entry>::iterator p)
+{
+    stats_.bytes -= p->bytes;
+    --stats_.entries;
+    index.erase(p->key);
+    entries.erase(p);
+}
+
+//------------------------------------------------------------------------------
+
+void Program_cache::shrink()
+{
+    while (stats_.bytes > limit && !entries.empty()) {
+        erase(prev(entries.end()));
+        ++stats_.evictions;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void Program_cache::set_limit(size_t bytes)
+{
+    limit = bytes;
+    shrink();
+}
+
+//------------------------------------------------------------------------------
+
+void Program_cache::clear()
+{
+    index.clear();
+    entries.clear();
+    stats_.bytes = 0;
+    stats_.entries = 0;
+}
@@ -0,0 +1,300 @@
+//
+// Native code for the simple calculator: see the Jit_program class in calculator.h.
+//
+// The stack of the Program maps onto registers: stack entry i lives in xmm<i>, so a
+// program that needs at most 14 stack entries runs without touching memory except
+// to load and store variables. xmm15 is a scratch register.
+// The generated function is   int f(double* vars, double* result)   (System V ABI):
+// it returns 0 (Error_code::none) and stores the result, or returns the Error_code it failed with.
+// Every operation is the same IEEE double operation that the interpreter does
+// (addsd for +, sqrtsd for sqrt(), a call of pow() for pow, ...), so the results are identical.
+//
+
+#include "calculator.h"
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__unix__) && !defined(CALC_NO_JIT)
+#define CALC_HAVE_JIT 1
+#include <sys/mman.h>
+#endif
+
+//------------------------------------------------------------------------------
+
+const int jit_errors = int(Error_code::not_int) + 1;    //the generated code fails with Error_code 1..not_int:
+                                                        //the errors of running a Program
+
+//------------------------------------------------------------------------------
+
+double Jit_program::run() const
+{
+    if (!fn) return prog.run();
+    double d;
+    int err = fn(prog.symbol_table().values(), &d);
+    if (err) error(Error{Error_code(err), string_view()}.message());
+    return d;
+}
+
+//------------------------------------------------------------------------------
+
+#ifdef CALC_HAVE_JIT
+
+const int max_registers = 14;       //stack entries kept in xmm0..xmm13
+const int scratch = 15;             //xmm15
+const int save_area = 112;          //space to save xmm0..xmm13 around a call of pow(); the temporaries follow
+
+//------------------------------------------------------------------------------
+// A buffer of x86-64 machine code, with the few instructions the calculator needs.
+// reg and rm are register numbers: 0-15 for xmm registers, 0 (eax), 1 (ecx), 2 (edx) for ints.
+
+class Code_buffer {
+public:
+    vector<unsigned char> bytes;
+    vector<int> labels;                    //position of each label, -1 until it is placed
+    vector<pair<int,int>> fixups;          //(position of a rel32, label it jumps to)
+
+    void byte(int b) { bytes.push_back(b); }
+    void int32(int v) { for (int i = 0; i<4; ++i) byte((v>>(8*i))&0xff); }
+    void int64(unsigned long long v) { for (int i = 0; i<8; ++i) byte((v>>(8*i))&0xff); }
+
+    int new_label() { labels.push_back(-1); return labels.size()-1; }
+    void place(int label) { labels[label] = bytes.size(); }
+    void rel32(int label) { fixups.push_back({int(bytes.size()), label}); int32(0); }
+    void jump(int label) { byte(0xE9); rel32(label); }                 //jmp
+    void jump_if(int cc, int label) { byte(0x0F); byte(0x80|cc); rel32(label); }   //jcc
+    void resolve();
+
+    //sse2: prefix [rex] 0F op modrm, register to register
+    void sse(int prefix, int op, int reg, int rm, bool wide = false)
+    {
+        byte(prefix);
+        int rex = (wide ? 8 : 0) | ((reg&8) ? 4 : 0) | ((rm&8) ? 1 : 0);
+        if (rex) byte(0x40|rex);
+        byte(0x0F); byte(op);
+        byte(0xC0 | (reg&7)<<3 | (rm&7));
+    }
+    //sse2 with memory operand [base+disp32]; base is rbx (3) or rsp (4)
+    void sse_mem(int prefix, int op, int reg, int base, int disp)
+    {
+        byte(prefix);
+        if (reg&8) byte(0x44);
+        byte(0x0F); byte(op);
+        byte(0x80 | (reg&7)<<3 | base);
+        if (base == 4) byte(0x24);        //SIB for rsp
+        int32(disp);
+    }
+    void load_constant(int x, double d)   //movabs rax,d; movq xmm<x>,rax
+    {
+        unsigned long long bits;
+        memcpy(&bits, &d, sizeof(d));
+        byte(0x48); byte(0xB8); int64(bits);
+        sse(0x66, 0x6E, x, 0, true);
+    }
+};
+
+//------------------------------------------------------------------------------
+
+void Code_buffer::resolve()
+{
+    for (auto& f : fixups) {
+        int rel = labels[f.second] - (f.first+4);
+        for (int i = 0; i<4; ++i) bytes[f.first+i] = (rel>>(8*i))&0xff;
+    }
+}
+
+//------------------------------------------------------------------------------
+// condition codes for jump_if()
+
+const int cc_below = 0x2, cc_equal = 0x4, cc_not_equal = 0x5, cc_parity = 0xA;
+
+//------------------------------------------------------------------------------
+// opcodes: F2 0F xx for movsd/addsd/..., 66 0F xx for movq/ucomisd/xorpd
+
+const int movsd_load = 0x10, movsd_store = 0x11, sqrtsd = 0x51, addsd = 0x58, mulsd = 0x59,
+          subsd = 0x5C, divsd = 0x5E, cvtsi2sd = 0x2A, cvttsd2si = 0x2C, ucomisd = 0x2E, xorpd = 0x57;
+
+//------------------------------------------------------------------------------
+//jump to bad if xmm<x> isn't an int (what narrow_cast<int> checks); leaves the int in eax or ecx
+
+static void check_int(Code_buffer& c, int x, int r, int bad)
+{
+    c.sse(0xF2, cvttsd2si, r, x);             //r = int(x), out of range gives -2147483648
+    c.sse(0xF2, cvtsi2sd, scratch, r);        //xmm15 = double(r)
+    c.sse(0x66, ucomisd, scratch, x);
+    c.jump_if(cc_parity, bad);                //x is NaN
+    c.jump_if(cc_not_equal, bad);
+}
+
+//------------------------------------------------------------------------------
+// translate prog into c; false if the program isn't something the JIT does
+
+static bool translate(const Program& prog, Code_buffer& c)
+{
+    if (prog.is_declaration() || prog.has_arrays() || prog.stack_size() > max_registers) return false;
+    int frame = save_area + 8 + 16*((prog.temp_count()+1)/2);     //keeps rsp 16-byte aligned
+
+    int error_label[jit_errors];
+    for (int i = 1; i<jit_errors; ++i) error_label[i] = c.new_label();
+    int done = c.new_label();
+
+    c.byte(0x53);                                  //push rbx
+    c.byte(0x41); c.byte(0x54);                    //push r12
+    c.byte(0x48); c.byte(0x81); c.byte(0xEC); c.int32(frame);   //sub rsp,frame
+    c.byte(0x48); c.byte(0x89); c.byte(0xFB);      //mov rbx,rdi: vars
+    c.byte(0x49); c.byte(0x89); c.byte(0xF4);      //mov r12,rsi: result
+
+    int sp = 0;          //stack depth; the top is xmm<sp-1>
+    for (const Instruction& in : prog.instructions()) {
+        int a = sp-2;    //left operand of a binary operation, gets the result
+        int b = sp-1;    //right operand, or the only operand
+        switch (in.op) {
+        case Op::number:
+            c.load_constant(sp++, in.value);
+            break;
+        case Op::load:
+            c.sse_mem(0xF2, movsd_load, sp++, 3, 8*in.slot);      //movsd xmm,[rbx+8*slot]
+            break;
+        case Op::assign:
+        {   unsigned long long bits;
+            memcpy(&bits, &in.value, sizeof(double));
+            c.byte(0x48); c.byte(0xB8); c.int64(bits);                         //movabs rax,value
+            c.byte(0x48); c.byte(0x89); c.byte(0x83); c.int32(8*in.slot);      //mov [rbx+8*slot],rax
+            break;
+        }
+        case Op::negate:
+            c.load_constant(scratch, -0.0);            //flip the sign bit, like unary -
+            c.sse(0x66, xorpd, b, scratch);
+            break;
+        case Op::add:
+            c.sse(0xF2, addsd, a, b);
+            --sp;
+            break;
+        case Op::subtract:
+            c.sse(0xF2, subsd, a, b);
+            --sp;
+            break;
+        case Op::multiply:
+            c.sse(0xF2, mulsd, a, b);
+            --sp;
+            break;
+        case Op::divide:
+        {   int ok = c.new_label();
+            c.sse(0x66, xorpd, scratch, scratch);      //xmm15 = 0
+            c.sse(0x66, ucomisd, b, scratch);
+            c.jump_if(cc_parity, ok);                  //NaN isn't 0
+            c.jump_if(cc_equal, error_label[int(Error_code::divide_by_zero)]);
+            c.place(ok);
+            c.sse(0xF2, divsd, a, b);
+            --sp;
+            break;
+        }
+        case Op::to_int:
+            check_int(c, b, 0, error_label[int(Error_code::not_int)]);
+            break;
+        case Op::modulo:
+        case Op::int_modulo:
+        {   int minus_one = c.new_label();
+            int next = c.new_label();
+            if (in.op == Op::modulo) {
+                check_int(c, a, 0, error_label[int(Error_code::not_int)]);     //eax = left
+                check_int(c, b, 1, error_label[int(Error_code::not_int)]);     //ecx = right
+            }
+            else {                                                 //known to be ints
+                c.sse(0xF2, cvttsd2si, 0, a);
+                c.sse(0xF2, cvttsd2si, 1, b);
+            }
+            c.byte(0x85); c.byte(0xC9);                        //test ecx,ecx
+            c.jump_if(cc_equal, error_label[int(Error_code::modulo_by_zero)]);
+            c.byte(0x83); c.byte(0xF9); c.byte(0xFF);          //cmp ecx,-1
+            c.jump_if(cc_equal, minus_one);
+            c.byte(0x99);                                      //cdq
+            c.byte(0xF7); c.byte(0xF9);                        //idiv ecx: edx = eax%ecx
+            c.sse(0xF2, cvtsi2sd, a, 2);                       //left = double(edx)
+            c.jump(next);
+            c.place(minus_one);
+            c.sse(0x66, xorpd, a, a);                          //x % -1 is 0
+            c.place(next);
+            --sp;
+            break;
+        }
+        case Op::square_root:
+        {   int ok = c.new_label();
+            c.sse(0x66, xorpd, scratch, scratch);
+            c.sse(0x66, ucomisd, b, scratch);
+            c.jump_if(cc_parity, ok);                  //NaN isn't < 0
+            c.jump_if(cc_below, error_label[int(Error_code::negative_sqrt)]);
+            c.place(ok);
+            c.sse(0xF2, sqrtsd, b, b);
+            break;
+        }
+        case Op::power:
+        {   //pow() may change all xmm registers: save the stack, call, restore
+            for (int i = 0; i<sp; ++i) c.sse_mem(0xF2, movsd_store, i, 4, 8*i);      //movsd [rsp+8*i],xmm<i>
+            if (a != 0) c.sse_mem(0xF2, movsd_load, 0, 4, 8*a);
+            c.sse_mem(0xF2, movsd_load, 1, 4, 8*b);
+            double (*f)(double, double) = ::pow;
+            c.byte(0x48); c.byte(0xB8); c.int64(reinterpret_cast<unsigned long long>(f));   //movabs rax,pow
+            c.byte(0xFF); c.byte(0xD0);                                                   //call rax
+            if (a != 0) c.sse(0xF2, movsd_load, a, 0);                                    //movsd xmm<a>,xmm0
+            for (int i = 0; i<a; ++i) c.sse_mem(0xF2, movsd_load, i, 4, 8*i);
+            --sp;
+            break;
+        }
+        case Op::save:
+            c.sse_mem(0xF2, movsd_store, b, 4, save_area+8*in.slot);      //movsd [rsp+...],xmm<top>
+            break;
+        case Op::restore:
+            c.sse_mem(0xF2, movsd_load, sp++, 4, save_area+8*in.slot);
+            break;
+        default:         //the array instructions, which has_arrays() already turned away
+            return false;
+        }
+    }
+    if (sp != 1) return false;
+
+    c.byte(0xF2); c.byte(0x41); c.byte(0x0F); c.byte(movsd_store); c.byte(0x04); c.byte(0x24);   //movsd [r12],xmm0
+    c.byte(0x31); c.byte(0xC0);                          //xor eax,eax
+    c.place(done);
+    c.byte(0x48); c.byte(0x81); c.byte(0xC4); c.int32(frame);   //add rsp,frame
+    c.byte(0x41); c.byte(0x5C);                          //pop r12
+    c.byte(0x5B);                                        //pop rbx
+    c.byte(0xC3);                                        //ret
+
+    for (int i = 1; i<jit_errors; ++i) {
+        c.place(error_label[i]);
+        c.byte(0xB8); c.int32(i);                        //mov eax,i
+        c.jump(done);
+    }
+    c.resolve();
+    return true;
+}
+
+#endif
+
+//------------------------------------------------------------------------------
+
+Jit_program::Jit_program(const Program& p)
+    :prog(p), mem(nullptr), mem_size(0), fn(nullptr)
+{
+#ifdef CALC_HAVE_JIT
+    Code_buffer c;
+    if (!translate(prog, c)) return;
+    mem_size = c.bytes.size();
+    mem = mmap(nullptr, mem_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        mem = nullptr;
+        return;
+    }
+    memcpy(mem, &c.bytes[0], mem_size);
+    if (mprotect(mem, mem_size, PROT_READ|PROT_EXEC) != 0) return;   //i.e. not allowed: use the interpreter
+    fn = reinterpret_cast<int (*)(double*, double*)>(mem);
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+Jit_program::~Jit_program()
+{
+#ifdef CALC_HAVE_JIT
+    if (mem) munmap(mem, mem_size);
+#endif
+}
@@ -0,0 +1,88 @@
+// This is the interactive program for the simple calculator of Chapter 7 of
+// "Programming -- Principles and Practice Using C++" by Bjarne Stroustrup
+//
+//                Revised by Timofey Golubev June 2018
+//
+// Reads statements from cin and prints their results. See calculator.cpp for the grammar.
+// With a file name argument, reads the statements from that file instead (without prompts),
+// running statements that don't depend on each other in parallel.
+// With --server path, serves sessions on the Unix domain socket path until interrupted (see Server in calculator.h).
+// With --format text|shortest|csv|binary, prints the results that way (see Output_format in calculator.h).
+// With --stats, prints where the time went at the end (see Stats in calculator.h); that needs -DCALC_STATS.
+// Build: g++ -std=c++17 -O2 calculator.cpp calculator_optimize.cpp calculator_cache.cpp calculator_parallel.cpp calculator_stats.cpp calculator_server.cpp calculator_array.cpp calculator_main.cpp -o calculator -pthread
+
+#include "calculator.h"
+#include <csignal>
+
+//----------------------------------------------------------------------
+
+Server* server = nullptr;
+
+void stop_server(int)
+{
+    if (server) server->stop();
+}
+
+//----------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+
+	try {
+        bool stats = false;
+        string path;
+        string socket_path;
+        Output_format format = Output_format::text;
+        for (int i = 1; i<argc; ++i) {
+            if (argv[i] == string("--stats")) stats = true;
+            else if (argv[i] == string("--format") && i+1 < argc) {
+                string f = argv[++i];
+                if (f == "text") format = Output_format::text;
+                else if (f == "shortest") format = Output_format::shortest;
+                else if (f == "csv") format = Output_format::csv;
+                else if (f == "binary") format = Output_format::binary;
+                else error("unknown output format ", f);
+            }
+            else if (argv[i] == string("--server") && i+1 < argc) socket_path = argv[++i];
+            else path = argv[i];
+        }
+        if (socket_path != "") {            //serve until SIGINT or SIGTERM
+            Server s(socket_path);
+            server = &s;
+            signal(SIGINT, stop_server);
+            signal(SIGTERM, stop_server);
+            s.run();
+            server = nullptr;
+            if (stats) print_stats(cerr, stats_snapshot());
+            return 0;
+        }
+        Calculator calc;                    //pi, e and k are predefined
+        if (path != "") {                   //run a script file
+            Input_file script(path);
+            calc.run_script(script.text(), cout, cerr, 0, format);
+            if (stats) print_stats(cerr, stats_snapshot());
+            return 0;
+        }
+        if (format == Output_format::csv || format == Output_format::binary) {     //only the results on cout
+            Token_stream ts;
+            calc.calculate(ts, cout, cerr, format);
+            if (stats) print_stats(cerr, stats_snapshot());
+            return 0;
+        }
+        cout << "Welcome to our simple calculator." <<endl;
+        cout <<"Please enter expressions followed by  ; and [Enter] key to print the result. Scientific e notation (i.e. 1e2 = 100) can be used" <<endl;
+        cout <<"Operators +,-,*,/, %(for int) are avalable. Variables can be defined using 'let', i.e. let x = 5;" << endl;
+        cout << "Predefined types pi, e, and k = 1000 and functions sqrt(), pow(x,i) = x^i (x and i can be any expression) are also available." << endl;
+        cout << "To quit, use 'quit' followed by [Enter] key" << endl;
+        Token_stream ts;
+        calc.calculate(ts, cout, cerr, format);
+        if (stats) print_stats(cerr, stats_snapshot());
+		return 0;
+	}
+	catch (exception& e) {
+		cerr << "exception: " << e.what() << endl;
+		return 1;
+	}
+	catch (...) {
+		cerr << "exception\n";
+		return 2;
+	}
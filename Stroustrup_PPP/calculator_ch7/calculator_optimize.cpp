@@ -0,0 +1,321 @@
+//
+// The optimizer for the simple calculator: see optimize() in calculator.h.
+//
+// The postfix code of a Program is turned into a graph (a DAG) of nodes, where equal
+// subexpressions become the same node. While the graph is built, constant subexpressions
+// are computed and identities are simplified. Then the graph is written back as postfix
+// code in the original order: a node used more than once is computed once, saved into a
+// temporary and restored where it's used again.
+//
+// Everything that's computed here is computed exactly as run() would, so the results
+// don't change, with one exception: pow(x,2) becomes x*x, which is the correctly rounded
+// square; pow() is off by one bit for a few arguments. optimize(prog, true) leaves it.
+// An operation that would fail (1/0, sqrt(-1), 2.5%2, ...) is never computed here:
+// it stays in the code, so run() reports the same error, in the same order.
+//
+// Each node also gets the range of its value if it is always an integer. Integers of less
+// than 2^53 are exact as doubles, and so are their sums, differences and products while they
+// stay below that, so + - * of integer nodes are integer nodes with the range computed from
+// theirs. % and its int check give ints too. That's what lets the int check and the checks of
+// % go: they can't fail for an integer in the range of an int.
+// A load of a variable is never an integer node, even for a variable that has only ever held
+// integers: the Program can run again after an assignment (in the Program_cache, or a Batch
+// with other columns), so only what's in the code is known. A counter x gets the int path only
+// past its int check: (x%7)%5 keeps the check of x, and both % are int_modulo; x*2 is a double.
+//
+// The graph and the other work space are allocated in an Arena that each thread reuses for
+// every statement, so optimizing a statement doesn't allocate once the arena has grown.
+//
+
+#include "calculator.h"
+#include <cstring>
+
+//------------------------------------------------------------------------------
+
+template<class T> using Arena_vector = vector<T, Arena_allocator<T>>;
+
+//------------------------------------------------------------------------------
+
+struct Node {
+    Op op;            //number, load or an operation
+    int a;            //operands: indexes of nodes, -1 if none
+    int b;
+    int slot;         //for load
+    double value;     //for number
+    bool neg_zero;    //can the value be -0? (x+0 is x only if it can't)
+    bool integral;    //the value is always an integer from lo to hi
+    double lo;
+    double hi;
+};
+
+const double max_exact = 9007199254740992.0;     //2^53: the integers below are exact doubles, and so is + - * of them
+
+static bool fits_int(const Node& n)         //the value is always something narrow_cast<int> accepts
+{
+    return n.integral && -2147483648.0 <= n.lo && n.hi <= 2147483647.0;
+}
+
+//------------------------------------------------------------------------------
+
+class Graph {
+public:
+    Graph(Arena& arena, int max_nodes, bool exact);
+    Arena_vector<Node> nodes;
+    int make(Op op, int a, int b = -1, int slot = 0, double value = 0);   //an equal node, or a new one
+    int number(double d) { return make(Op::number, -1, -1, 0, d); }
+    bool is_number(int n) const { return nodes[n].op == Op::number; }
+    bool is_number(int n, double d) const      //the same bits as d, so -0 isn't 0
+    {
+        return is_number(n) && memcmp(&nodes[n].value, &d, sizeof(double)) == 0;
+    }
+    double value(int n) const { return nodes[n].value; }
+    int combine(Op op, int a, int b = -1);     //the node for a op b, simplified
+private:
+    Arena_vector<int> index;       //open addressing hash table of nodes, -1 for an empty entry
+    size_t mask;
+    bool exact;                    //no pow(x,2) -> x*x
+};
+
+//------------------------------------------------------------------------------
+
+Graph::Graph(Arena& arena, int max_nodes, bool exact)
+    : nodes(arena), index(arena), mask(15), exact(exact)
+{
+    nodes.reserve(max_nodes);      //so nodes never moves
+    while (mask < 2*max_nodes) mask = 2*mask+1;   //at most half full
+    index.assign(mask+1, -1);
+}
+
+//------------------------------------------------------------------------------
+
+int Graph::make(Op op, int a, int b, int slot, double value)
+{
+    unsigned long long bits;
+    memcpy(&bits, &value, sizeof(double));
+    int x = a, y = b;
+    if ((op == Op::add || op == Op::multiply) && y < x) swap(x, y);   //a+b and b+a are the same node
+    size_t h = 14695981039346656037ull;
+    for (unsigned long long k : {(unsigned long long)op, (unsigned long long)x, (unsigned long long)y,
+                                 (unsigned long long)slot, bits})
+        h = (h ^ k) * 1099511628211ull;
+    size_t i = (h ^ h>>29) & mask;
+    for ( ; index[i] >= 0; i = (i+1)&mask) {
+        const Node& n = nodes[index[i]];
+        int nx = n.a, ny = n.b;
+        if ((op == Op::add || op == Op::multiply) && ny < nx) swap(nx, ny);
+        if (n.op == op && nx == x && ny == y && n.slot == slot && memcmp(&n.value, &value, sizeof(double)) == 0)
+            return index[i];
+    }
+
+    bool neg_zero = true;
+    switch (op) {
+    case Op::number:   neg_zero = (value == 0 && signbit(value)); break;
+    case Op::add:      neg_zero = nodes[a].neg_zero && nodes[b].neg_zero; break;   //-0 + -0 is the only -0 sum
+    case Op::subtract: neg_zero = nodes[a].neg_zero; break;
+    case Op::to_int:
+    case Op::square_root: neg_zero = nodes[a].neg_zero; break;
+    case Op::modulo:
+    case Op::int_modulo: neg_zero = false; break;    //an int converted to double
+    default: break;
+    }
+
+    bool integral = false;
+    double lo = 0, hi = 0;
+    auto range = [&](double l, double h) {     //rounded bounds below 2^53 are below it exactly
+        if (-max_exact < l && h < max_exact) {
+            integral = true;
+            lo = l;
+            hi = h;
+        }
+    };
+    const Node* x_node = (a >= 0) ? &nodes[a] : nullptr;
+    const Node* y_node = (b >= 0) ? &nodes[b] : nullptr;
+    bool both = x_node && y_node && x_node->integral && y_node->integral;
+    switch (op) {
+    case Op::number:
+        if (value == floor(value)) range(value, value);
+        break;
+    case Op::negate:
+        if (x_node->integral) range(-x_node->hi, -x_node->lo);
+        break;
+    case Op::add:
+        if (both) range(x_node->lo+y_node->lo, x_node->hi+y_node->hi);
+        break;
+    case Op::subtract:
+        if (both) range(x_node->lo-y_node->hi, x_node->hi-y_node->lo);
+        break;
+    case Op::multiply:
+        if (both) {
+            double p[] = {x_node->lo*y_node->lo, x_node->lo*y_node->hi, x_node->hi*y_node->lo, x_node->hi*y_node->hi};
+            range(*min_element(p, p+4), *max_element(p, p+4));
+        }
+        break;
+    case Op::to_int:            //if the check passes, the value is an int
+        if (x_node->integral) range(max(x_node->lo, -2147483648.0), min(x_node->hi, 2147483647.0));
+        else range(-2147483648.0, 2147483647.0);
+        break;
+    case Op::modulo:            //i1%i2 is between -|i1| and |i1|, and smaller than |i2|, with the sign of i1
+    case Op::int_modulo:
+    {   double m1 = x_node->integral ? max(-x_node->lo, x_node->hi) : 2147483648.0;
+        double m2 = y_node->integral ? max(-y_node->lo, y_node->hi) : 2147483648.0;
+        double m = max(min(m1, m2-1), 0.0);
+        range((x_node->integral && x_node->lo >= 0) ? 0 : -m, (x_node->integral && x_node->hi <= 0) ? 0 : m);
+        break;
+    }
+    default:
+        break;
+    }
+    nodes.push_back(Node{op, a, b, slot, value, neg_zero, integral, lo, hi});
+    index[i] = nodes.size()-1;
+    return nodes.size()-1;
+}
+
+//------------------------------------------------------------------------------
+
+static bool is_int(double d)        //what narrow_cast<int>(d) accepts
+{
+    return -2147483648.0 <= d && d <= 2147483647.0 && double(int(d)) == d;
+}
+
+//------------------------------------------------------------------------------
+
+int Graph::combine(Op op, int a, int b)
+{
+    bool constant = is_number(a) && (b < 0 || is_number(b));
+    switch (op) {
+    case Op::negate:
+        if (constant) return number(-value(a));
+        if (nodes[a].op == Op::negate) return nodes[a].a;     //- - x is x
+        break;
+    case Op::add:
+        if (constant) return number(value(a)+value(b));
+        if (is_number(b,-0.0) || (is_number(b,0.0) && !nodes[a].neg_zero)) return a;   //x+0 is x, unless x is -0
+        if (is_number(a,-0.0) || (is_number(a,0.0) && !nodes[b].neg_zero)) return b;
+        break;
+    case Op::subtract:
+        if (constant) return number(value(a)-value(b));
+        if (is_number(b,0.0)) return a;                       //x-0 is x, also for -0
+        break;
+    case Op::multiply:
+        if (constant) return number(value(a)*value(b));
+        if (is_number(b,1.0)) return a;
+        if (is_number(a,1.0)) return b;
+        break;
+    case Op::divide:
+        if (is_number(b) && value(b) == 0) break;             //leave the error to run()
+        if (constant) return number(value(a)/value(b));
+        if (is_number(b,1.0)) return a;
+        break;
+    case Op::to_int:
+        if (fits_int(nodes[a])) return a;           //the check passes: nothing to do at run time (i.e. a constant)
+        break;
+    case Op::modulo:
+    case Op::int_modulo:
+        if (constant && is_int(value(a)) && is_int(value(b)) && int(value(b)) != 0) {
+            int i1 = int(value(a));
+            int i2 = int(value(b));
+            return number((i2 == -1) ? 0 : i1%i2);
+        }
+        if (fits_int(nodes[a]) && fits_int(nodes[b])) return make(Op::int_modulo, a, b);
+        break;
+    case Op::square_root:
+        if (constant && !(value(a) < 0)) return number(sqrt(value(a)));
+        break;
+    case Op::power:
+        if (constant) return number(pow(value(a),value(b)));
+        if (is_number(b,2.0) && !exact) return combine(Op::multiply, a, a);
+        break;
+    default:
+        break;
+    }
+    return make(op, a, b);
+}
+
+//------------------------------------------------------------------------------
+
+void optimize(Program& prog, bool exact)
+{
+    if (prog.is_eager()) return;                   //it has already run
+    if (prog.has_arrays()) return;                 //the graph has only numbers
+    for (const Instruction& in : prog.instructions())
+        if (in.op == Op::assign || in.op == Op::save || in.op == Op::restore) return;   //assignments change values between loads
+
+    const Symbol_table& st = prog.symbol_table();
+    static thread_local Arena arena(1<<16);
+    arena.reset();
+    Graph g(arena, prog.size(), exact);
+    Arena_vector<int> captured(arena);
+    Arena_vector<int> stack(arena);          //nodes, as the code would compute them
+    stack.reserve(prog.stack_size());
+    for (const Instruction& in : prog.instructions()) {
+        switch (in.op) {
+        case Op::number:
+            stack.push_back(g.number(in.value));
+            break;
+        case Op::load:
+            if (st.is_constant(in.slot)) {           //i.e. pi
+                stack.push_back(g.number(st.value(in.slot)));
+                if (find(captured.begin(), captured.end(), in.slot) == captured.end()) captured.push_back(in.slot);
+            }
+            else stack.push_back(g.make(Op::load, -1, -1, in.slot));
+            break;
+        case Op::negate:
+        case Op::to_int:
+        case Op::square_root:
+            stack.back() = g.combine(in.op, stack.back());
+            break;
+        default:                  //binary operations
+        {   int b = stack.back();
+            stack.pop_back();
+            stack.back() = g.combine(in.op, stack.back(), b);
+            break;
+        }
+        }
+    }
+    if (stack.size() != 1) return;
+    int root = stack[0];
+
+    //count the uses of each node that's still part of the statement
+    Arena_vector<int> uses(g.nodes.size(), 0, arena);
+    Arena_vector<int> todo(arena);
+    todo.reserve(g.nodes.size());
+    todo.push_back(root);
+    uses[root] = 1;
+    while (!todo.empty()) {
+        int n = todo.back();
+        todo.pop_back();
+        for (int child : {g.nodes[n].a, g.nodes[n].b})
+            if (child >= 0 && uses[child]++ == 0) todo.push_back(child);
+    }
+
+    //write the graph as postfix code, the operands of a node in their original order,
+    //into prog (the graph has all we need of its code), so the code keeps its capacity
+    int decl_slot = prog.declared_slot();
+    prog.clear();
+    Program& out = prog;
+    Arena_vector<int> temp(g.nodes.size(), -1, arena);      //temporary of a node that's been computed and saved
+    int temps = 0;
+    Arena_vector<pair<int,int>> work(arena);   //(node, number of operands done)
+    work.reserve(g.nodes.size());
+    work.push_back({root,0});
+    while (!work.empty()) {
+        int n = work.back().first;
+        const Node& node = g.nodes[n];
+        if (temp[n] >= 0) {                    //computed before
+            out.emit(Op::restore, temp[n]);
+            work.pop_back();
+            continue;
+        }
+        int done = work.back().second++;
+        if (done == 0 && node.a >= 0) { work.push_back({node.a,0}); continue; }
+        if (done <= 1 && node.b >= 0) { work.back().second = 2; work.push_back({node.b,0}); continue; }
+        work.pop_back();
+        out.emit(node.op, node.slot, node.value);
+        if (uses[n] > 1 && node.op != Op::number && node.op != Op::load) {   //loading again is as cheap as restoring
+            temp[n] = temps++;
+            out.emit(Op::save, temp[n]);
+        }
+    }
+    if (decl_slot >= 0) out.declare(decl_slot);
+    for (int slot : captured) out.capture(slot);
+}
@@ -0,0 +1,236 @@
+//
+// Parallel batch mode for the simple calculator: see Calculator::run_script() in calculator.h.
+//
+// The script is split into segments, each ending at a ';'. A segment is what calculate()
+// reads between two ';': a statement, or a few if they aren't separated by ';' (i.e. "1 2;").
+// The names a segment uses are found by scanning its text, without parsing it. A name is
+// written by "let name" and by "name = ", the assignment done by Token_stream::get();
+// all other uses read it. A segment depends on the earlier segments that write a name it
+// reads or writes, and on those that read a name it writes.
+//
+// A segment becomes a task once all segments it depends on are done. Each thread has a
+// queue of ready tasks: it takes the newest task of its own queue, and when that's empty,
+// steals the oldest task of another thread's queue; when there is none, it sleeps until a
+// finished task makes others ready, or the last one is done. The output of each segment is kept
+// and printed in the order of the script, so it's the same as that of calculate().
+//
+// That holds as long as a failed statement is skipped up to its own ';'. One that fails
+// after reading its ';' (i.e. "(1;") makes calculate() skip the next statement as well;
+// then the whole script is run again with calculate(), one statement after the other.
+//
+
+#include "calculator.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+//------------------------------------------------------------------------------
+
+class Work_queue {          //the ready tasks of one thread
+public:
+    void push(int task)
+    {
+        lock_guard<mutex> lock(m);
+        tasks.push_back(task);
+    }
+    bool pop(int& task)     //the newest task, for the thread that owns the queue
+    {
+        lock_guard<mutex> lock(m);
+        if (tasks.empty()) return false;
+        task = tasks.back();
+        tasks.pop_back();
+        return true;
+    }
+    bool steal(int& task)   //the oldest task, for the other threads
+    {
+        lock_guard<mutex> lock(m);
+        if (tasks.empty()) return false;
+        task = tasks.front();
+        tasks.pop_front();
+        return true;
+    }
+private:
+    mutex m;
+    deque<int> tasks;
+};
+
+//------------------------------------------------------------------------------
+
+struct Segment {
+    string_view text;       //up to and including the ';'
+    vector<int> reads;      //slots
+    vector<int> writes;
+    bool has_quit;          //calculate() may stop here
+};
+
+//------------------------------------------------------------------------------
+//split text into segments and find the names each uses. All names are interned into st here,
+//so while the tasks run, the Symbol_table only changes the values and flags of existing slots.
+
+static vector<Segment> scan(string_view text, Symbol_table& st)
+{
+    vector<Segment> segments;
+    const char* p = text.data();
+    const char* last = p+text.size();
+    while (p != last) {
+        Segment s {string_view(), {}, {}, false};
+        const char* first = p;
+        bool after_let = false;
+        while (p != last && *p != print) {
+            if (isalpha(*p)) {                      //as Token_stream::get() reads names
+                const char* q = p;
+                while (p!=last && (isalpha(*p) || isdigit(*p) || *p == '_')) ++p;
+                string_view name(q, p-q);
+                if (name == declkey) { after_let = true; continue; }
+                if (name == quitkey) s.has_quit = true;
+                if (name == quitkey || name == sqrt_key || name == power_key) continue;
+                const char* r = p;
+                while (r!=last && isspace(*r)) ++r;
+                int slot = st.intern(name);
+                if (after_let || (r!=last && *r == '=')) s.writes.push_back(slot);
+                else s.reads.push_back(slot);
+                after_let = false;
+            }
+            else if (isdigit(*p) || *p == '.') {    //skip numbers, so the e in 1e5 isn't a name
+                double d;
+                if (const char* q = read_number(p, last, d)) p = q;
+                else {                              //the statement fails here and is skipped up to the ';'
+                    while (p!=last && *p != print) ++p;
+                }
+            }
+            else ++p;
+        }
+        if (p != last) ++p;                         //the ';'
+        s.text = string_view(first, p-first);
+        segments.push_back(s);
+    }
+    return segments;
+}
+
+//------------------------------------------------------------------------------
+
+void Calculator::run_script(string_view text, ostream& os, ostream& errors, int threads, Output_format format)
+{
+    if (threads <= 0) threads = thread::hardware_concurrency();
+    if (table.is_reactive()) threads = 1;       //define() of a reactive table records the formulas and who depends
+                                                //on what: statements on other threads would change those at once
+    Symbol_table vars = table;                  //the tasks work on a copy, in case the script must be run again
+    vector<Segment> segments = scan(text, vars);
+    int n = 0;                                  //segments run as tasks: those before the first quit
+    while (n < segments.size() && !segments[n].has_quit) ++n;
+    if (threads < 2 || n < 2) {
+        Token_stream ts(text);
+        calculate(ts, os, errors, format);
+        return;
+    }
+
+    //the dependencies
+    vector<vector<int>> after(n);               //the segments that wait for segment i
+    unique_ptr<atomic<int>[]> waiting(new atomic<int>[n]);
+    vector<int> last_write(vars.size(), -1);
+    vector<vector<int>> reads_since(vars.size());    //segments that read a slot after its last write
+    for (int i = 0; i<n; ++i) {
+        vector<int> before;
+        for (int slot : segments[i].reads) {
+            if (last_write[slot] >= 0) before.push_back(last_write[slot]);
+            reads_since[slot].push_back(i);
+        }
+        for (int slot : segments[i].writes) {
+            if (last_write[slot] >= 0) before.push_back(last_write[slot]);
+            for (int r : reads_since[slot]) before.push_back(r);
+            reads_since[slot].clear();
+            last_write[slot] = i;
+        }
+        sort(before.begin(), before.end());
+        before.erase(unique(before.begin(), before.end()), before.end());
+        if (!before.empty() && before.back() == i) before.pop_back();   //a segment that reads and writes a slot
+        for (int b : before) after[b].push_back(i);
+        waiting[i] = before.size();
+    }
+
+    //the tasks
+    vector<string> outputs(n);
+    vector<string> error_outputs(n);
+    vector<Work_queue> queues(threads);
+    for (int i = 0; i<n; ++i)
+        if (waiting[i] == 0) queues[i%threads].push(i);
+    atomic<int> remaining(n);
+    atomic<bool> failed(false);                 //a statement ran on into the next segment
+    mutex idle_m;                               //a thread with nothing to do waits on idle
+    condition_variable idle;
+    long changes = 0;                           //tasks pushed, and the end: guarded by idle_m
+    auto changed = [&] {
+        {
+            lock_guard<mutex> lock(idle_m);
+            ++changes;
+        }
+        idle.notify_all();
+    };
+
+    auto worker = [&](int id) {
+        Program prog(vars);
+        prog.set_eager(true);
+        prog.set_nesting_limit(this->prog.nesting_limit());
+        ostringstream out;                      //reused: making a stream per task costs more than most statements
+        ostringstream err;
+        while (remaining > 0 && !failed) {
+            int task;
+            if (!queues[id].pop(task)) {
+                long seen;
+                {
+                    lock_guard<mutex> lock(idle_m);
+                    seen = changes;             //a push after this changes it, so the wait below won't miss it
+                }
+                bool found = false;
+                for (int i = 1; i<threads && !found; ++i) found = queues[(id+i)%threads].steal(task);
+                if (!found) {                   //wait for another thread to finish a task that others wait for
+                    unique_lock<mutex> lock(idle_m);
+                    idle.wait(lock, [&] { return changes != seen; });
+                    continue;
+                }
+            }
+            try {
+                Token_stream ts(segments[task].text);
+                out.str("");
+                err.str("");
+                if (!::calculate(ts, prog, out, err, format) && task < segments.size()-1) failed = true;
+                outputs[task] = out.str();
+                error_outputs[task] = err.str();
+            }
+            catch (...) {                       //i.e. bad_alloc: let calculate() find it again
+                failed = true;
+            }
+            bool pushed = false;
+            for (int next : after[task])
+                if (--waiting[next] == 0) {
+                    queues[id].push(next);
+                    pushed = true;
+                }
+            if (--remaining == 0 || failed || (pushed && threads > 1)) changed();
+        }
+    };
+    vector<thread> pool;
+    for (int i = 1; i<threads; ++i) pool.push_back(thread(worker, i));
+    worker(0);
+    for (thread& t : pool) t.join();
+
+    if (failed) {                               //run it one statement after the other
+        Token_stream ts(text);
+        calculate(ts, os, errors, format);
+        return;
+    }
+    table = vars;
+    for (int i = 0; i<n; ++i) {                 //a segment prints its results before its error, if any
+        os << outputs[i];
+        errors << error_outputs[i];
+    }
+    os.flush();
+    if (n < segments.size()) {                  //the rest, from the first quit
+        const char* rest = segments[n].text.data();
+        Token_stream ts(string_view(rest, text.data()+text.size()-rest));
+        calculate(ts, os, errors, format);
+    }
+}
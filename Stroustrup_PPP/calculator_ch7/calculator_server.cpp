@@ -0,0 +1,273 @@
+//
+// Server mode for the simple calculator: see the Server class in calculator.h.
+//
+// One thread serves all connections, in a poll() loop; the sockets don't block. What a
+// connection sends is collected until it has a ';'. Then all the complete statements in it
+// are run at once, with calculate() on the text (no copy into a stream), and all their
+// results go out in one write. So a client that sends a thousand statements in one write
+// costs one read, one pass of calculate() and one write, not a thousand of each.
+//
+// A statement that fails after reading its ';' (i.e. "(1;") makes calculate() skip the next
+// statement as well, as it does on cin; if that one hasn't arrived yet, it's skipped when it
+// does. A connection whose results the client doesn't read isn't read from either, once too
+// much output is waiting.
+//
+
+#include "calculator.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CALC_HAVE_SOCKETS 1
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+//------------------------------------------------------------------------------
+
+#ifdef CALC_HAVE_SOCKETS
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0      //i.e. macOS: a client that went away gives EPIPE, SIGPIPE is ignored in run()
+#endif
+
+const size_t max_pending_output = 1<<20;   //don't read from a connection that has this much output waiting
+const size_t max_statement = 1<<26;        //close a connection that sends this much without a ';'
+
+//------------------------------------------------------------------------------
+
+struct Connection {
+    int fd;
+    Calculator calc;            //the variables of this session
+    string in;                  //received, not yet run
+    string out;                 //results not yet sent, from out_pos
+    size_t out_pos;
+    ostringstream results;      //reused for each batch
+    bool skipping;              //skip up to the next ';' (see above)
+    bool closing;               //after quit or the end of the input: send what's left, then close
+    explicit Connection(int fd) : fd(fd), out_pos(0), skipping(false), closing(false) { }
+};
+
+//------------------------------------------------------------------------------
+
+static void set_nonblocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+//------------------------------------------------------------------------------
+//is s the quit token, and nothing else? Only once white space has ended it: "quit" could
+//still become "quitter;"
+
+static bool just_quit(string_view s)
+{
+    size_t first = s.find_first_not_of(" \t\r\n");
+    if (first == string_view::npos) return false;
+    s.remove_prefix(first);
+    return s.size() > quitkey.size() && s.compare(0, quitkey.size(), quitkey) == 0
+        && s.find_first_not_of(" \t\r\n", quitkey.size()) == string_view::npos;
+}
+
+//------------------------------------------------------------------------------
+//run the complete statements in c.in; all of it at the end of the input, or when what
+//follows the last ';' is a quit (a client that ends with "quit" and no ';' mustn't wait)
+
+static void run_statements(Connection& c, bool end_of_input)
+{
+    size_t last = c.in.rfind(print);
+    if (just_quit(string_view(c.in).substr(last == string::npos ? 0 : last+1))) end_of_input = true;
+    size_t n = c.in.size();
+    if (!end_of_input) n = (last == string::npos) ? 0 : last+1;
+    string_view text(c.in.data(), n);
+    if (c.skipping && !text.empty()) {
+        size_t p = text.find(print);
+        if (p != string_view::npos) {
+            text.remove_prefix(p+1);
+            c.skipping = false;
+        }
+        else text = string_view();
+    }
+    if (!text.empty()) {
+        Token_stream ts(text);
+        c.results.str("");
+        bool complete = c.calc.calculate(ts, c.results, c.results);
+        if (!ts.at_end()) c.closing = true;      //it stopped at quit
+        else if (!complete) c.skipping = true;
+        if (c.out_pos == c.out.size()) {
+            c.out.clear();
+            c.out_pos = 0;
+        }
+        c.out += c.results.str();
+    }
+    c.in.erase(0, n);
+    if (end_of_input) c.closing = true;
+}
+
+//------------------------------------------------------------------------------
+
+static bool receive(Connection& c)     //false if the connection failed
+{
+    char buf[1<<16];
+    size_t tail = c.in.size();                  //received since the last ';' (run_statements() left none in c.in)
+    while (true) {
+        ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            c.in.append(buf, n);
+            string_view got(buf, n);
+            size_t last = got.rfind(print);
+            tail = (last == string_view::npos) ? tail+n : n-last-1;
+            if (tail > max_statement) return false;
+            continue;
+        }
+        if (n == 0) {                           //the client has sent all it will
+            run_statements(c, true);
+            return true;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        return false;
+    }
+    run_statements(c, false);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+static bool send_pending(Connection& c)     //false if the connection failed
+{
+    while (c.out_pos < c.out.size()) {
+        ssize_t n = send(c.fd, c.out.data()+c.out_pos, c.out.size()-c.out_pos, MSG_NOSIGNAL);
+        if (n > 0) {
+            c.out_pos += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+        return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+Server::Server(const string& p)
+    : path(p), listen_fd(-1), wake{-1, -1}
+{
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) error("server: socket path too long: ", path);
+    memcpy(addr.sun_path, path.c_str(), path.size()+1);
+    try {                                   //~Server() doesn't run for a constructor that throws
+        if (pipe(wake) < 0) error("server: can't make a pipe");
+        set_nonblocking(wake[0]);
+        set_nonblocking(wake[1]);
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0) error("server: can't make a socket");
+        unlink(path.c_str());               //left by a server that was killed
+        if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) error("server: can't bind ", path);
+        if (listen(listen_fd, SOMAXCONN) < 0) error("server: can't listen on ", path);
+        set_nonblocking(listen_fd);
+    }
+    catch (...) {
+        close_all();
+        throw;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+Server::~Server()
+{
+    close_all();
+}
+
+void Server::close_all()
+{
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(path.c_str());
+        listen_fd = -1;
+    }
+    for (int& fd : wake)
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+}
+
+//------------------------------------------------------------------------------
+
+void Server::stop()
+{
+    char c = 0;
+    ssize_t n = write(wake[1], &c, 1);      //only async-signal-safe calls here
+    (void)n;
+}
+
+//------------------------------------------------------------------------------
+
+void Server::run()
+{
+    signal(SIGPIPE, SIG_IGN);
+    vector<unique_ptr<Connection>> connections;
+    vector<pollfd> fds;
+    while (true) {
+        fds.clear();
+        fds.push_back(pollfd{wake[0], POLLIN, 0});
+        fds.push_back(pollfd{listen_fd, POLLIN, 0});
+        for (const auto& c : connections) {
+            short events = 0;
+            size_t pending = c->out.size()-c->out_pos;
+            if (!c->closing && pending < max_pending_output) events |= POLLIN;
+            if (pending > 0) events |= POLLOUT;
+            fds.push_back(pollfd{c->fd, events, 0});
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            error("server: poll failed");
+        }
+        if (fds[0].revents) {                   //stop()
+            char buf[64];
+            while (read(wake[0], buf, sizeof(buf)) > 0) { }
+            break;
+        }
+
+        for (size_t i = 0; i<connections.size(); ++i) {
+            Connection& c = *connections[i];
+            short r = fds[i+2].revents;
+            bool ok = true;
+            if (!c.closing && (r & (POLLIN|POLLHUP|POLLERR))) ok = receive(c);
+            if (ok) ok = send_pending(c);
+            if (!ok || (c.closing && c.out_pos == c.out.size())) {
+                close(c.fd);
+                connections[i].reset();
+            }
+        }
+        connections.erase(remove(connections.begin(), connections.end(), nullptr), connections.end());
+
+        if (fds[1].revents & POLLIN) {          //new connections
+            while (true) {
+                int fd = accept(listen_fd, nullptr, nullptr);
+                if (fd < 0) break;
+                set_nonblocking(fd);
+                connections.push_back(make_unique<Connection>(fd));
+            }
+        }
+    }
+    for (const auto& c : connections) close(c->fd);
+}
+
+//------------------------------------------------------------------------------
+
+#else
+
+Server::Server(const string& p) : path(p), listen_fd(-1), wake{-1, -1} { error("server: no Unix domain sockets on this system"); }
+Server::~Server() { }
+void Server::close_all() { }
+void Server::stop() { }
+void Server::run() { }
+
+#endif
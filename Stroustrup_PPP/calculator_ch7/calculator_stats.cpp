@@ -0,0 +1,203 @@
+//
+// The statistics of the simple calculator: see Phase_timer and stats_snapshot() in calculator.h.
+//
+// Each thread has a Thread_stats that only it writes, so counting is a plain add, without
+// locks or locked instructions. stats_snapshot() reads the records of the running threads
+// and the totals of those that have ended. Time is counted in ticks of stats_ticks(); the
+// snapshot converts them to seconds with the rate measured against the steady_clock.
+//
+// Without -DCALC_STATS, there is nothing to count: stats_snapshot() returns zeros.
+//
+
+#include "calculator.h"
+
+//------------------------------------------------------------------------------
+
+double Stats::percentile(double p) const
+{
+    long n = 0;
+    for (long c : latency) n += c;
+    if (n == 0) return 0;
+    long seen = 0;
+    for (int i = 0; i<latency_buckets; ++i) {
+        seen += latency[i];
+        if (seen >= n*p/100) return double(2ll<<i)/ticks_per_second;    //the end of the bucket
+    }
+    return double(2ll<<(latency_buckets-1))/ticks_per_second;
+}
+
+//------------------------------------------------------------------------------
+
+#ifdef CALC_STATS
+
+#include <mutex>
+
+//------------------------------------------------------------------------------
+
+struct Totals {
+    long counters[number_of_counters];
+    long long ticks[number_of_phases];
+    long latency[latency_buckets];
+};
+
+static void add(Totals& t, const Thread_stats& s)
+{
+    for (int i = 0; i<number_of_counters; ++i) t.counters[i] += s.counters[i].load(memory_order_relaxed);
+    for (int i = 0; i<number_of_phases; ++i) t.ticks[i] += s.ticks[i].load(memory_order_relaxed);
+    for (int i = 0; i<latency_buckets; ++i) t.latency[i] += s.latency[i].load(memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+
+struct Registry {
+    mutex m;
+    vector<const Thread_stats*> running;
+    Totals ended;              //of the threads that have ended
+    Totals base;               //subtracted: the totals at the last reset_stats()
+    long long start_ticks;     //for the tick rate
+    chrono::steady_clock::time_point start_time;
+    Registry() : ended{}, base{}, start_ticks(stats_ticks()), start_time(chrono::steady_clock::now()) { }
+};
+
+static Registry& registry()     //made by the first thread that counts, before anyone needs it
+{
+    static Registry r;
+    return r;
+}
+
+//------------------------------------------------------------------------------
+
+thread_local Thread_stats thread_stats;
+
+Thread_stats::Thread_stats()
+    : counters{}, ticks{}, latency{}, current(Phase::none), since(stats_ticks())
+{
+    Registry& r = registry();
+    lock_guard<mutex> lock(r.m);
+    r.running.push_back(this);
+}
+
+Thread_stats::~Thread_stats()
+{
+    Registry& r = registry();
+    lock_guard<mutex> lock(r.m);
+    add(r.ended, *this);
+    r.running.erase(find(r.running.begin(), r.running.end(), this));
+}
+
+//------------------------------------------------------------------------------
+
+long long Statement_timer::busy()
+{
+    switch_phase(thread_stats.current);      //bring the ticks of the current phase up to date
+    long long t = 0;
+    for (Phase p : {Phase::lex, Phase::parse, Phase::lookup, Phase::eval, Phase::recovery})
+        t += thread_stats.ticks[int(p)].load(memory_order_relaxed);
+    return t;
+}
+
+void Statement_timer::stop()
+{
+    long long t = busy()-start;
+    int bucket = 0;
+    while (bucket < latency_buckets-1 && (2ll<<bucket) <= t) ++bucket;
+    stats_add(thread_stats.latency[bucket], 1L);
+    stats_count(Counter::statements);
+}
+
+//------------------------------------------------------------------------------
+
+static Totals totals(Registry& r)      //r.m is locked
+{
+    Totals t = r.ended;
+    for (const Thread_stats* s : r.running) add(t, *s);
+    return t;
+}
+
+//------------------------------------------------------------------------------
+
+Stats stats_snapshot()
+{
+    switch_phase(thread_stats.current);      //bring this thread's current phase up to date
+    Registry& r = registry();
+    double ticks_per_second = 1e9;
+#if defined(__x86_64__) || defined(__i386__)
+    auto elapsed = [&] { return chrono::duration<double>(chrono::steady_clock::now()-r.start_time).count(); };
+    while (elapsed() < 0.01) { }         //long enough to measure the rate
+    ticks_per_second = (stats_ticks()-r.start_ticks)/elapsed();
+#endif
+    lock_guard<mutex> lock(r.m);
+    Totals t = totals(r);
+    Stats s {};
+    s.enabled = true;
+    s.ticks_per_second = ticks_per_second;
+    for (int i = 0; i<number_of_counters; ++i) s.counters[i] = t.counters[i]-r.base.counters[i];
+    for (int i = 0; i<number_of_phases; ++i) s.seconds[i] = (t.ticks[i]-r.base.ticks[i])/ticks_per_second;
+    for (int i = 0; i<latency_buckets; ++i) s.latency[i] = t.latency[i]-r.base.latency[i];
+    return s;
+}
+
+//------------------------------------------------------------------------------
+
+void reset_stats()
+{
+    switch_phase(thread_stats.current);
+    Registry& r = registry();
+    lock_guard<mutex> lock(r.m);
+    r.base = totals(r);
+}
+
+//------------------------------------------------------------------------------
+
+#else
+
+Stats stats_snapshot()
+{
+    Stats s {};
+    s.ticks_per_second = 1e9;
+    return s;
+}
+
+void reset_stats() { }
+
+#endif
+
+//------------------------------------------------------------------------------
+
+void print_stats(ostream& os, const Stats& s)
+{
+    if (!s.enabled) {
+        os << "statistics: not compiled in (build with -DCALC_STATS)\n";
+        return;
+    }
+    long statements = s.count(Counter::statements);
+    double busy = 0;
+    for (Phase p : {Phase::lex, Phase::parse, Phase::lookup, Phase::eval, Phase::recovery}) busy += s.time(p);
+    os << "statistics:\n"
+       << "  statements : " << statements << '\n'
+       << "  tokens     : " << s.count(Counter::tokens);
+    if (s.time(Phase::lex) > 0) os << " (" << s.count(Counter::tokens)/s.time(Phase::lex)/1e6 << " M tokens/s lexing)";
+    os << '\n'
+       << "  lookups    : " << s.count(Counter::lookups);
+    if (statements > 0) os << " (" << double(s.count(Counter::lookups))/statements << " per statement)";
+    os << '\n'
+       << "  errors     : " << s.count(Counter::errors) << '\n';
+
+    const char* names[number_of_phases] = {"other", "input", "lex", "parse", "lookup", "eval", "recovery"};
+    ios_base::fmtflags flags = os.flags();
+    streamsize precision = os.precision();
+    os << "  time (ms):\n" << fixed;
+    for (int i = 0; i<number_of_phases; ++i) {
+        os << "    " << setw(9) << left << names[i] << right << setprecision(3) << setw(12) << s.seconds[i]*1e3;
+        if (i >= int(Phase::lex) && busy > 0) os << setprecision(1) << setw(8) << s.seconds[i]/busy*100 << " %";
+        os << '\n';
+    }
+    os.flags(flags);
+    os.precision(precision);
+    if (statements == 0) return;
+    os << "  latency (us): p50 " << s.percentile(50)*1e6 << ", p90 " << s.percentile(90)*1e6
+       << ", p99 " << s.percentile(99)*1e6 << ", max " << s.percentile(100)*1e6 << '\n';
+    for (int i = 0; i<latency_buckets; ++i)
+        if (s.latency[i])
+            os << "    < " << setw(10) << (2ll<<i)/s.ticks_per_second*1e6 << " : " << s.latency[i] << '\n';
+}